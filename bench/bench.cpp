@@ -0,0 +1,426 @@
+/* Benchmarks for the mbgfx and mbchart hot paths. Runs headless on an
+    offscreen window and prints one CSV line per case:
+      benchmark,param,samples,ops_per_sample,mean_ns,p50_ns,p99_ns,max_ns
+    where the timings are per operation; cases prefixed raster_ use the
+    TiledRaster backend. Pass a .ttf file as the first argument to include
+    text drawing. Exits with 1, before timing anything, if the batch colour
+    functions disagree with the scalar ones or CompressedHistory does not
+    give back the points it was given. */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "mbchart.h"
+#include "mbgfx.h"
+
+using Clock = std::chrono::steady_clock;
+
+// times `samples` runs of `body`, each doing `opsPerSample` operations, and
+// prints the per-operation distribution
+static void measure(const char *name, long param, int samples,
+                    int opsPerSample, std::function<void()> body) {
+  body(); // warm up caches and lazily created resources
+  std::vector<double> times;
+  times.reserve(samples);
+  for (int i = 0; i < samples; i++) {
+    Clock::time_point start = Clock::now();
+    body();
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+    times.push_back(elapsed.count() / opsPerSample);
+  }
+  std::sort(times.begin(), times.end());
+  double sum = 0;
+  for (double t : times) {
+    sum += t;
+  }
+  printf("%s,%ld,%d,%d,%.1f,%.1f,%.1f,%.1f\n", name, param, samples,
+         opsPerSample, sum / samples, times[samples / 2],
+         times[std::min(samples - 1, (int)(samples * 0.99))], times.back());
+  fflush(stdout);
+}
+
+static void benchDataSet() {
+  const int batch = 10000;
+  for (int maxSize : {1000, 100000, 1000000}) {
+    ChartTools::DataSet set(maxSize);
+    double x = 0;
+    measure("dataset_addPoint", maxSize, 200, batch, [&]() {
+      for (int i = 0; i < batch; i++, x++) {
+        set.addPoint(x, std::sin(x));
+      }
+    });
+    measure("dataset_addPoint2", maxSize, 200, batch, [&]() {
+      for (int i = 0; i < batch; i++, x++) {
+        set.addPoint2(std::sin(x));
+      }
+    });
+    ChartTools::CompactDataSet<float> compact(maxSize);
+    measure("compactdataset_float_addPoint2", maxSize, 200, batch, [&]() {
+      for (int i = 0; i < batch; i++, x++) {
+        compact.addPoint2(std::sin(x));
+      }
+    });
+    ChartTools::DataSet historySet(maxSize);
+    historySet.enableHistory(10 * maxSize);
+    measure("dataset_history_addPoint2", maxSize, 200, batch, [&]() {
+      for (int i = 0; i < batch; i++, x++) {
+        historySet.addPoint2(std::round(std::sin(x * 0.001) * 1000) / 8);
+      }
+    });
+  }
+
+  ChartTools::DataSet set(1000000);
+  for (int i = 0; i < 1000000; i++) {
+    set.addPoint2(std::sin(i * 0.001));
+  }
+  for (int n : {10, 1000, 100000}) {
+    volatile double sink;
+    measure("dataset_averageLastPoints", n, 200, 100, [&]() {
+      for (int i = 0; i < 100; i++) {
+        sink = set.averageLastPoints(n);
+      }
+    });
+  }
+}
+
+// channel differences of more than one step between two colours
+static bool apart(GraphicsTools::ColorRgba8 x, GraphicsTools::ColorRgba8 y) {
+  return std::abs(x.r - y.r) > 1 || std::abs(x.g - y.g) > 1 ||
+         std::abs(x.b - y.b) > 1 || std::abs(x.a - y.a) > 1;
+}
+
+// checks the batch colour functions against the scalar ones, at every
+// length up to a few SIMD groups so that each tail length is covered, and
+// at hues on and beside the sector boundaries; returns the number of
+// colours more than one step apart
+static int checkColors() {
+  using GraphicsTools::ColorHsv;
+  using GraphicsTools::ColorRgba8;
+  std::mt19937 generator(1);
+  std::uniform_int_distribution<int> channel(0, 255);
+  int failures = 0;
+
+  const double weights[][2] = {{1, 1}, {1, 2}, {3, 7}, {0, 1}, {1, 0}, {255, 1}};
+  for (int count = 1; count <= 13; count++) {
+    std::vector<ColorRgba8> a(count), b(count), out(count);
+    for (int i = 0; i < count; i++) {
+      a[i] = ColorRgba8(channel(generator), channel(generator),
+                        channel(generator), channel(generator));
+      b[i] = ColorRgba8(channel(generator), channel(generator),
+                        channel(generator), channel(generator));
+    }
+    for (auto &w : weights) {
+      GraphicsTools::blend(a.data(), w[0], b.data(), w[1], out.data(), count);
+      for (int i = 0; i < count; i++) {
+        ColorRgba8 scalar =
+            GraphicsTools::blend(a[i].rgba(), w[0], b[i].rgba(), w[1]);
+        if (apart(out[i], scalar)) {
+          fprintf(stderr, "blend: colour %d of %d, weights %g:%g\n", i, count,
+                  w[0], w[1]);
+          failures++;
+        }
+      }
+    }
+  }
+
+  std::vector<ColorHsv> hsv;
+  for (int sector = 0; sector <= 6; sector++) {
+    for (double h : {sector * 60.0, std::nextafter(sector * 60.0, 0.0),
+                     std::nextafter(sector * 60.0, 400.0), sector * 60.0 + 30}) {
+      for (double sv : {0.0, 0.5, 1.0}) {
+        hsv.push_back(ColorHsv({h, sv, 1}));
+        hsv.push_back(ColorHsv({h, 1, sv}));
+      }
+    }
+  }
+  for (int count = 1; count <= (int)hsv.size(); count++) {
+    std::vector<ColorRgba8> out(count);
+    GraphicsTools::hsv2rgb(hsv.data(), out.data(), count);
+    for (int i = 0; i < count; i++) {
+      GraphicsTools::ColorRgba c = GraphicsTools::hsv2rgb(hsv[i]);
+      if (apart(out[i], ColorRgba8(c.r * 255, c.g * 255, c.b * 255))) {
+        fprintf(stderr, "hsv2rgb: colour %d of %d, h %.17g s %g v %g\n", i,
+                count, hsv[i].h, hsv[i].s, hsv[i].v);
+        failures++;
+      }
+    }
+  }
+  return failures;
+}
+
+static bool sameBits(double a, double b) {
+  return memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+// compares what a CompressedHistory gives back with the points that went
+// in, bit for bit; expected is the run of input points the history should
+// still hold, oldest first
+static int compareHistory(const char *name,
+                          const std::vector<ChartTools::ChartPoint> &out,
+                          const ChartTools::ChartPoint *expected, int count) {
+  if ((int)out.size() != count) {
+    fprintf(stderr, "history %s: %d points read back, %d expected\n", name,
+            (int)out.size(), count);
+    return 1;
+  }
+  for (int i = 0; i < count; i++) {
+    if (!sameBits(out[i].x, expected[i].x) ||
+        !sameBits(out[i].y, expected[i].y)) {
+      fprintf(stderr, "history %s: point %d is %.17g,%.17g, not %.17g,%.17g\n",
+              name, i, out[i].x, out[i].y, expected[i].x, expected[i].y);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// round-trips points through CompressedHistory: irregular x, special y
+// values and a block size that leaves a partly filled block, with and
+// without the oldest blocks being dropped; returns the number of failures
+static int checkHistory() {
+  using ChartTools::ChartPoint;
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<double> unit(0, 1);
+  const int count = 10007;
+  std::vector<ChartPoint> points(count);
+  const double special[] = {NAN,
+                            -NAN,
+                            INFINITY,
+                            -INFINITY,
+                            0.0,
+                            -0.0,
+                            std::numeric_limits<double>::denorm_min(),
+                            std::numeric_limits<double>::max(),
+                            std::numeric_limits<double>::lowest()};
+  double x = 1.7e9, y = 0;
+  for (int i = 0; i < count; i++) {
+    // steps of zero, of jitter and of the occasional gap
+    double r = unit(generator);
+    x += r < 0.1 ? 0 : r < 0.95 ? 0.1 + unit(generator) * 1e-3 : r * 1e4;
+    y += unit(generator) - 0.5;
+    points[i] = ChartPoint(x, i % 13 == 0 ? special[(i / 13) % 9] : y);
+  }
+
+  int failures = 0;
+  std::vector<ChartPoint> out;
+  for (int blockSize : {1, 7, 1024}) {
+    ChartTools::CompressedHistory whole(count, blockSize);
+    for (auto &p : points) {
+      whole.append(p);
+    }
+    out.clear();
+    whole.read(-INFINITY, INFINITY, out);
+    failures += compareHistory("whole", out, points.data(), count);
+
+    // the oldest blocks are dropped, so what is left is the newest points
+    ChartTools::CompressedHistory rolling(count / 3, blockSize);
+    for (auto &p : points) {
+      rolling.append(p);
+    }
+    out.clear();
+    rolling.read(-INFINITY, INFINITY, out);
+    int kept = rolling.size();
+    if (kept > count / 3 || kept < count / 3 - blockSize) {
+      fprintf(stderr, "history rolling: %d points kept of %d\n", kept,
+              count / 3);
+      failures++;
+    }
+    failures += compareHistory("rolling", out, points.data() + count - kept,
+                               kept);
+  }
+
+  // what a DataSet evicts goes into its history, so between them they hold
+  // every point added
+  ChartTools::DataSet set(500);
+  set.enableHistory(count, 64);
+  for (auto &p : points) {
+    set.addPoint(p.x, p.y);
+  }
+  out.clear();
+  set.readHistory(-INFINITY, INFINITY, out);
+  for (int i = 0; i < set.getCurrentSize(); i++) {
+    out.push_back(set.getPoint(i));
+  }
+  failures += compareHistory("dataset", out, points.data(), count);
+  return failures;
+}
+
+static void benchColors() {
+  const int count = 1024;
+  std::vector<GraphicsTools::ColorRgba8> a(count, GraphicsTools::Colors::Red),
+      b(count, GraphicsTools::Colors::Blue), out(count);
+  measure("colors_blend_batch", count, 200, count, [&]() {
+    GraphicsTools::blend(a.data(), 1, b.data(), 3, out.data(), count);
+  });
+  measure("colors_blend_scalar", count, 200, count, [&]() {
+    for (int i = 0; i < count; i++) {
+      out[i] = GraphicsTools::blend(a[i].rgba(), 1, b[i].rgba(), 3);
+    }
+  });
+  std::vector<GraphicsTools::ColorHsv> hsv(count);
+  for (int i = 0; i < count; i++) {
+    hsv[i] = GraphicsTools::ColorHsv({i * 360.0 / count, 0.8, 0.9});
+  }
+  measure("colors_hsv2rgb_batch", count, 200, count, [&]() {
+    GraphicsTools::hsv2rgb(hsv.data(), out.data(), count);
+  });
+  measure("colors_hsv2rgb_scalar", count, 200, count, [&]() {
+    for (int i = 0; i < count; i++) {
+      GraphicsTools::ColorRgba c = GraphicsTools::hsv2rgb(hsv[i]);
+      out[i] = GraphicsTools::ColorRgba8(c.r * 255, c.g * 255, c.b * 255);
+    }
+  });
+}
+
+// prefix names the window backend in the benchmark names
+static void benchLineChart(GraphicsTools::Window &win, std::string prefix) {
+  for (int points : {1000, 10000, 100000, 1000000}) {
+    ChartTools::DataSet set(points);
+    for (int i = 0; i < points; i++) {
+      set.addPoint2(std::sin(i * 0.01) * 5 + 5);
+    }
+    ChartTools::LineChart chart(&win, &set, 100, 50, 1000, 600);
+    chart.setScaleModes(ChartTools::SCALE_MIN | ChartTools::SCALE_MAX,
+                        ChartTools::SCALE_MIN | ChartTools::SCALE_MAX);
+    int samples = points >= 1000000 ? 10 : 50;
+    measure((prefix + "linechart_draw").c_str(), points, samples, 1, [&]() {
+      win.clear();
+      chart.draw();
+      win.update();
+    });
+    chart.setDecimation(ChartTools::DECIMATE_M4);
+    measure((prefix + "linechart_draw_m4").c_str(), points, samples, 1, [&]() {
+      win.clear();
+      chart.draw();
+      win.update();
+    });
+    // a strip chart: one new point per frame
+    chart.setDecimation(ChartTools::NO_DECIMATION);
+    chart.setScrolling(true);
+    int next = points;
+    measure((prefix + "linechart_draw_scrolling").c_str(), points, samples, 1,
+            [&]() {
+              set.addPoint2(std::sin(next++ * 0.01) * 5 + 5);
+              win.clear();
+              chart.draw();
+              win.update();
+            });
+  }
+
+  // a fixed x-axis reaching back over ten times the buffered points, most
+  // of them decoded from the compressed history
+  ChartTools::DataSet set(10000);
+  set.enableHistory(100000);
+  for (int i = 0; i < 110000; i++) {
+    set.addPoint2(std::round(std::sin(i * 0.01) * 500) / 100 + 5);
+  }
+  ChartTools::LineChart chart(&win, &set, 100, 50, 1000, 600);
+  chart.setAxes(0, 110000, 0, 10);
+  measure((prefix + "linechart_draw_history").c_str(), 100000, 50, 1, [&]() {
+    win.clear();
+    chart.draw();
+    win.update();
+  });
+}
+
+static void benchPrimitives(GraphicsTools::Window &win, std::string prefix,
+                            const char *fontFile) {
+  const int batch = 100;
+  for (int thickness : {1, 2, 4, 8}) {
+    measure((prefix + "window_drawLine").c_str(), thickness, 50, batch, [&]() {
+      for (int i = 0; i < batch; i++) {
+        win.drawLine(GraphicsTools::Colors::Green, thickness, 10, 10 + i * 5,
+                     1200, 700 - i * 5);
+      }
+      win.update();
+    });
+  }
+
+  for (int radius : {10, 50}) {
+    measure((prefix + "window_drawCircleGradient").c_str(), radius, 50, batch,
+            [&]() {
+              for (int i = 0; i < batch; i++) {
+                win.drawCircleGradient(GraphicsTools::Colors::Blue,
+                                       GraphicsTools::Colors::White,
+                                       60 + i * 10, 300, radius);
+              }
+              win.update();
+            });
+  }
+
+  if (fontFile != NULL) {
+    GraphicsTools::Font font(fontFile, 16);
+    measure((prefix + "window_drawText").c_str(), 0, 50, batch, [&]() {
+      for (int i = 0; i < batch; i++) {
+        win.drawText(std::to_string(i % 10), &font,
+                     GraphicsTools::Colors::White, 20, 20 + i * 5,
+                     GraphicsTools::TextAlignModeH::Right);
+      }
+      win.update();
+    });
+  }
+}
+
+// frame intervals of a FixedRate loop, whose spread is the pacing jitter
+static void benchPacing(GraphicsTools::Window &win) {
+  for (int fps : {60, 240}) {
+    win.setPresentMode(GraphicsTools::FixedRate, fps);
+    measure("window_frame_fixedrate", fps, 50, 1, [&]() {
+      win.waitFrame();
+      win.clear();
+      win.update();
+    });
+  }
+  win.setPresentMode(GraphicsTools::VSync);
+}
+
+int main(int argc, char **argv) {
+  if (GraphicsTools::InitGraphics(true) != 0) {
+    return 1;
+  }
+  const char *fontFile = NULL;
+  if (argc > 1) {
+    if (GraphicsTools::InitText() != 0) {
+      return 1;
+    }
+    fontFile = argv[1];
+  }
+
+  // the batch colour functions must agree with the scalar ones, and the
+  // compressed history must give back what went in, before their timings
+  // mean anything
+  if (checkColors() != 0 || checkHistory() != 0) {
+    return 1;
+  }
+
+  printf("benchmark,param,samples,ops_per_sample,mean_ns,p50_ns,p99_ns,max_ns\n");
+  benchColors();
+  {
+    GraphicsTools::Window win("bench", 1280, 720, GraphicsTools::Offscreen);
+    benchDataSet();
+    benchLineChart(win, "");
+    benchPrimitives(win, "", fontFile);
+    benchPacing(win);
+  }
+  {
+    GraphicsTools::Window win("bench", 1280, 720, GraphicsTools::Offscreen,
+                              GraphicsTools::TiledRaster);
+    benchLineChart(win, "raster_");
+    benchPrimitives(win, "raster_", fontFile);
+  }
+
+  if (fontFile != NULL) {
+    GraphicsTools::CloseText();
+  }
+  GraphicsTools::CloseGraphics();
+  return 0;
+}
@@ -0,0 +1,82 @@
+/* Background writer for recorded frames. The render thread reads each
+    frame into one of a fixed pool of buffers and queues it; a worker
+    thread encodes and writes the queued frames. */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SDL2/SDL.h"
+
+namespace GraphicsTools {
+
+// PNG writes one file per frame, naming it with a pattern that holds one
+// printf-style %d for the frame number (e.g. "frame%05d.png"); Raw appends
+// tightly packed RGBA8 frames to a single file
+enum CaptureFormat : int { CapturePNG, CaptureRaw };
+
+class FrameRecorder {
+public:
+  // buffers is the number of frames that can be queued or being written
+  // at once
+  FrameRecorder(std::string path, CaptureFormat format, int width, int height,
+                int buffers = 3);
+  // writes the frames still queued
+  ~FrameRecorder();
+
+  // a free buffer of width * height RGBA8 pixels for the next frame, or
+  // NULL if every buffer is still queued, in which case the frame is
+  // dropped; never waits for the writer
+  Uint8 *acquire();
+  // queues the buffer from acquire() as the given frame; a buffer that
+  // could not be filled goes back with release()
+  void submit(Uint8 *frame, int frameNumber);
+  void release(Uint8 *frame);
+
+  // false if the raw output file could not be opened, or the PNG pattern
+  // does not have exactly one frame number conversion
+  bool good() const {
+    return format == CaptureRaw ? rawFile != NULL : patternValid;
+  };
+
+  int written() const;
+  int dropped() const;
+  int failed() const;
+
+private:
+  std::string path;
+  CaptureFormat format;
+  int width, height;
+
+  struct QueuedFrame {
+    Uint8 *pixels;
+    int number;
+  };
+  std::vector<std::vector<Uint8>> storage;
+  std::vector<Uint8 *> freeBuffers;
+  std::deque<QueuedFrame> queue;
+  int writtenCount, droppedCount, failedCount;
+  bool stopping;
+  mutable std::mutex mutex;
+  std::condition_variable ready;
+  std::thread worker;
+  FILE *rawFile;
+  // PNG file names: the pattern split around its frame number
+  bool patternValid;
+  std::string namePrefix, nameSuffix;
+  bool zeroPad;
+  int numberWidth;
+
+  void workerLoop();
+  bool write(const QueuedFrame &frame);
+};
+
+} // namespace GraphicsTools
+
+#endif
@@ -1,7 +1,12 @@
 #ifndef CHARTS_H
 #define CHARTS_H
 
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
 #include <string>
+#include <vector>
 
 #include "mbgfx.h"
 
@@ -17,6 +22,13 @@ enum AutoScaleMode {
 
 AutoScaleMode operator|(AutoScaleMode lv, AutoScaleMode rv);
 
+// reduces large data sets to a few points per pixel column before drawing
+enum DecimationMode {
+  NO_DECIMATION = 0, // every point is drawn
+  DECIMATE_M4,  // keeps the first, min, max and last point of each column
+  DECIMATE_LTTB // largest-triangle-three-buckets, two points per column
+};
+
 struct ChartPoint {
   double x;
   double y;
@@ -24,24 +36,358 @@ struct ChartPoint {
   ChartPoint(double, double);
 };
 
-class DataSet {
+// a point that may still become a window minimum or maximum; seq is the
+// point's position in the sequence of all points added to its DataSet
+struct ExtremumCandidate {
+  int seq;
+  double value;
+};
+
+// a point waiting in a PointQueue; continuous-time points are given their
+// x when they are added to the DataSet
+struct QueuedPoint {
+  double x;
+  double y;
+  bool continuous;
+};
+
+// wait-free ring of points from one producer thread to one consumer thread
+class PointQueue {
+public:
+  PointQueue(int minCapacity); // rounded up to a power of two
+  ~PointQueue();
+  bool push(const QueuedPoint &p); // producer side; false if full
+  // consumer side; takes up to maxCount points, returns how many it took
+  int pop(QueuedPoint *out, int maxCount);
+  int getCapacity() const { return capacity; };
+  int size() const; // points waiting, as seen from the consumer side
+
+private:
+  int capacity;
+  QueuedPoint *slots;
+  // free-running positions, each written by one side only, kept on separate
+  // cache lines so the two threads don't contend
+  alignas(64) std::atomic<unsigned int> readPos;
+  alignas(64) std::atomic<unsigned int> writePos;
+};
+
+// min/max summary of an aligned run of points in a level-of-detail index;
+// index identifies the run (its first point's seq divided by the run length)
+struct LodBucket {
+  int index;
+  int minSeq;
+  int maxSeq;
+  double minY;
+  double maxY;
+};
+
+// a contiguous run of points in a DataSet's buffer
+struct DataSpan {
+  const ChartPoint *points;
+  int size;
+};
+
+// Points evicted from a DataSet, packed Gorilla-style into blocks of
+// blockSize points: each x is stored as the delta of the delta of its bit
+// pattern, each y XORed with the previous y, both in as few bits as their
+// leading and trailing zeros allow. Regular x and slowly changing y take a
+// few bits per point. Only the newest block is open for appending; the
+// oldest blocks are dropped to stay within maxPoints.
+class CompressedHistory {
+private:
+  struct Block {
+    std::vector<uint64_t> words;
+    size_t bitCount;
+    int count;
+    double minX;
+    double maxX;
+    // encoder state, used while the block is open
+    uint64_t prevX;
+    uint64_t prevY;
+    uint64_t prevDelta;
+    int prevLeading;
+    int prevTrailing;
+  };
+  std::deque<Block> blocks;
+  int maxPoints;
+  int blockSize;
+  int pointCount;
+  void decode(const Block &block, std::vector<ChartPoint> &out) const;
+
+public:
+  CompressedHistory(int maxPoints, int blockSize);
+  void append(const ChartPoint &p);
+  void clear();
+  int size() const { return pointCount; };
+  size_t bytes() const;
+  // appends the points of the blocks reaching into xFrom..xTo, oldest
+  // first, decoding nothing else; assumes x never decreases
+  void read(double xFrom, double xTo, std::vector<ChartPoint> &out) const;
+};
+
+// The points a LineChart draws, whatever their storage; logical index 0 is
+// the oldest point.
+class PointSource {
+public:
+  virtual ~PointSource() {}
+  virtual int drainQueue() = 0;
+  virtual int pendingPoints() const = 0;
+  virtual unsigned long getRevision() const = 0;
+  virtual int getCurrentSize() const = 0;
+  virtual const ChartPoint getPoint(int index) const = 0;
+  // points first..first+count-1, either in place or copied into scratch,
+  // which has room for count points
+  virtual const ChartPoint *readPoints(int first, int count,
+                                       ChartPoint *scratch) const = 0;
+  virtual double minX() const = 0;
+  virtual double maxX() const = 0;
+  virtual double minY() const = 0;
+  virtual double maxY() const = 0;
+  virtual bool hasLevelOfDetail() const = 0;
+  virtual void rangeExtrema(int first, int last, int *minIndex,
+                            int *maxIndex) const = 0;
+  virtual int lowerBoundX(double x) const = 0;
+  // older points kept compressed, if any (see DataSet::enableHistory)
+  virtual int historySize() const { return 0; }
+  virtual void readHistory(double /*xFrom*/, double /*xTo*/,
+                           std::vector<ChartPoint> & /*out*/) const {}
+};
+
+// What DataSet and CompactDataSet share: the queue through which one other
+// thread adds points, and the extrema of the stored points. Set is the
+// derived class, whose addPoint and addPoint2 drainQueue calls.
+template <typename Set> class RollingPointSource : public PointSource {
+public:
+  ~RollingPointSource();
+
+  // Lets one other thread add points without locking: it calls queuePoint
+  // or queuePoint2, which never block and return false (dropping the point)
+  // if the queue is full. The owning thread adds them with drainQueue,
+  // which LineChart::draw calls before drawing.
+  void enableQueue(int capacity);
+  bool queuePoint(double x, double y);
+  bool queuePoint2(double y);
+  int drainQueue(); // returns the number of points added
+  int pendingPoints() const { return ingest ? ingest->size() : 0; };
+
+  // extrema of the stored points (0 if empty), kept up to date as points
+  // are added and evicted
+  double minX() const;
+  double maxX() const;
+  double minY() const;
+  double maxY() const;
+
+protected:
+  RollingPointSource();
+
+  PointQueue *ingest; // NULL until enableQueue
+
+  // monotonic queues of the candidates for the minimum and maximum of each
+  // coordinate; the front of each is the current extremum
+  std::deque<ExtremumCandidate> minXQueue;
+  std::deque<ExtremumCandidate> maxXQueue;
+  std::deque<ExtremumCandidate> minYQueue;
+  std::deque<ExtremumCandidate> maxYQueue;
+  // adds point seq, first dropping the candidates older than oldestSeq
+  void pushExtremaX(int oldestSeq, int seq, double x);
+  void pushExtremaY(int oldestSeq, int seq, double y);
+  void clearExtrema();
+};
+
+class DataSet final : public RollingPointSource<DataSet> {
 private:
   int maxSize;
   int currentSize;
   int totalPoints;
+  int head; // buffer position of the oldest point
   ChartPoint *points;
+  bool ownsPoints; // false for a view of external points
+  unsigned long revision; // counts the changes to the points
+
+  // rolling statistics of y, all unused until enableRollingStats:
+  // cumulative sums of y and y^2 through each buffered point (parallel to
+  // points, rebased when the buffer wraps so they stay small),
+  double *sumY;
+  double *sumY2;
+  // the exponential moving average,
+  double emaAlpha;
+  double emaValue;
+  // and a log-bucketed sketch of the last quantileWindow values: values
+  // within a factor of quantileGamma share a bucket
+  int quantileWindow;
+  double quantileGamma;
+  std::map<int, int> positiveBuckets;
+  std::map<int, int> negativeBuckets;
+  int zeroCount;
+  int quantileBucket(double magnitude) const;
+  void updateSketch(double y, int delta);
+  void updateStats(int pos, double y);
+  double sumLastPoints(int numPoints, bool squares) const;
+
+  CompressedHistory *history; // NULL until enableHistory
+
+  // level-of-detail index: lodLevels[k] holds rings of buckets summarizing
+  // runs of 8^(k+1) points, enough of them to cover the whole buffer
+  std::vector<std::vector<LodBucket>> lodLevels;
+  void updateLod(int seq, double y);
+
+  // buffer position of the point at a logical index (0 is the oldest)
+  int bufferIndex(int index) const {
+    int i = head + index;
+    return (i >= maxSize) ? i - maxSize : i;
+  };
 
 public:
   DataSet(int setSize);
+  // A read-only view of count points owned by the caller, which must
+  // outlive it; nothing is copied. addPoint, addPoint2 and clear do
+  // nothing on a view. Given the lowest and highest x and y, the view
+  // doesn't have to read the points to find them.
+  DataSet(const ChartPoint *external, int count);
+  DataSet(const ChartPoint *external, int count, ChartPoint lowest,
+          ChartPoint highest);
   ~DataSet();
   void addPoint(double x, double y);
   void addPoint2(double y); // for continuous-time values
-  void clear() { currentSize = 0; };
-  const ChartPoint getPoint(int index) const { return points[index]; };
+  void clear();
+
+  const ChartPoint getPoint(int index) const {
+    return points[bufferIndex(index)];
+  };
+  const ChartPoint *readPoints(int first, int count,
+                               ChartPoint *scratch) const;
+
+  // the stored points, oldest first, as at most two contiguous runs split
+  // at the buffer's wrap point; the second run is empty if there is no wrap
+  DataSpan firstSpan() const;
+  DataSpan secondSpan() const;
 
   int getMaxSize() const { return maxSize; };
   int getCurrentSize() const { return currentSize; };
+  // changes whenever points are added or cleared
+  unsigned long getRevision() const { return revision; };
+
   double averageLastPoints(int numPoints) const;
+
+  // Keeps rolling statistics of y as points are added, so the queries below
+  // cost O(1), apart from quantile, which costs O(log of the value range).
+  // The quantile sketch covers the last quantileWindow points (0 for the
+  // whole buffer), with values accurate to within relative accuracy.
+  // averageLastPoints also becomes O(1).
+  void enableRollingStats(double emaAlpha = 0.1, int quantileWindow = 0,
+                          double accuracy = 0.01);
+  double varianceLastPoints(int numPoints) const;
+  double ema() const { return emaValue; };
+  double quantile(double q) const; // q between 0 and 1
+
+  // Keeps min/max summaries of aligned runs of 8, 64, 512... points as
+  // points are added, so rangeExtrema costs O(log n) rather than O(n).
+  // LineChart uses it to draw M4-decimated views of very large sets; that
+  // (and lowerBoundX) assumes x never decreases from one point to the next.
+  void enableLevelOfDetail();
+  bool hasLevelOfDetail() const { return !lodLevels.empty(); };
+  // logical indices of the lowest and highest y among points first..last
+  void rangeExtrema(int first, int last, int *minIndex, int *maxIndex) const;
+  // the first logical index whose x is at least x (getCurrentSize() if none)
+  int lowerBoundX(double x) const;
+
+  // Keeps up to maxPoints of the points pushed out of the buffer, as
+  // CompressedHistory blocks of blockSize points. LineChart decodes them
+  // when its x-axis reaches back before the buffered points, and decimates
+  // them like the buffered ones, except that DECIMATE_LTTB, which reads
+  // the buffered points in place, falls back to M4 for them.
+  void enableHistory(int maxPoints, int blockSize = 1024);
+  int historySize() const;
+  size_t historyBytes() const;
+  void readHistory(double xFrom, double xTo,
+                   std::vector<ChartPoint> &out) const;
+};
+
+// A DataSet for large rolling windows that stores each coordinate in its
+// own array, with y as T (float, int16_t, int32_t or double; values are
+// rounded and saturated to integer types). With implicitX only y is
+// stored, and each point's x is its position in the sequence of points
+// added, as addPoint2 gives it; otherwise x is kept as a double. It has no
+// rolling statistics or level-of-detail index.
+template <typename T>
+class CompactDataSet final : public RollingPointSource<CompactDataSet<T>> {
+private:
+  int maxSize;
+  int currentSize;
+  int totalPoints;
+  int head; // buffer position of the oldest point
+  T *ys;
+  double *xs; // NULL when x is implicit, which needs no x extrema
+  unsigned long revision;
+
+  int bufferIndex(int index) const {
+    int i = head + index;
+    return (i >= maxSize) ? i - maxSize : i;
+  };
+  double xAt(int index) const {
+    return xs ? xs[bufferIndex(index)]
+              : (double)(totalPoints - currentSize + index);
+  };
+
+public:
+  CompactDataSet(int setSize, bool implicitX = true);
+  ~CompactDataSet();
+  void addPoint(double x, double y); // x is ignored when implicit
+  void addPoint2(double y);
+  void clear();
+
+  const ChartPoint getPoint(int index) const {
+    return ChartPoint(xAt(index), ys[bufferIndex(index)]);
+  };
+  const ChartPoint *readPoints(int first, int count,
+                               ChartPoint *scratch) const;
+  int getMaxSize() const { return maxSize; };
+  int getCurrentSize() const { return currentSize; };
+  unsigned long getRevision() const { return revision; };
+  size_t bytesPerPoint() const {
+    return sizeof(T) + (xs ? sizeof(double) : 0);
+  };
+
+  // found from the first and last points when x is implicit
+  double minX() const;
+  double maxX() const;
+  bool hasLevelOfDetail() const { return false; };
+  // found by a scan of the range
+  void rangeExtrema(int first, int last, int *minIndex, int *maxIndex) const;
+  int lowerBoundX(double x) const;
+};
+
+// Series files hold a header, then header.count ChartPoints in the native
+// byte order, oldest first.
+struct SeriesFileHeader {
+  char magic[8];      // "MBSERIES"
+  uint32_t version;   // 1
+  uint32_t pointSize; // sizeof(ChartPoint)
+  uint64_t count;
+  double minX;
+  double maxX;
+  double minY;
+  double maxY;
+  char reserved[8]; // pads the header so the points stay aligned
+};
+
+// writes the points of a data set as a series file; returns 0 on success
+int saveSeries(const DataSet &set, std::string filename);
+
+// A series file mapped into memory, with a DataSet view of its points.
+// Pages are read in as the view touches them, so opening is immediate
+// whatever the file size. The view lasts as long as the MappedSeries.
+class MappedSeries {
+private:
+  void *mapping;
+  size_t mappingSize;
+  DataSet *view;
+
+public:
+  MappedSeries(std::string filename);
+  ~MappedSeries();
+  bool isOpen() const { return view != NULL; };
+  DataSet *data() const { return view; }; // NULL if the file can't be used
 };
 
 class LineChart {
@@ -76,28 +422,225 @@ private:
   double yAxisSmMin;
   double yAxisSmMax;
 
-  DataSet *data;
+  PointSource *data;
+  // room for a block of points read from data
+  std::vector<ChartPoint> readScratch;
+  // calls visit(points, count, firstIndex) on successive blocks of the
+  // points first..end-1
+  template <typename Visit> void forEachBlock(int first, int end, Visit visit);
 
-  // maps a data value to a position on the window.
+  // maps a data value to a position on the window, as
+  // position = value * scale + offset, recomputed when the axes change
+  double xScale;
+  double xOffset;
+  double yScale;
+  double yOffset;
+  void updateTransform();
   int mapX(double sourceVal);
   int mapY(double sourceVal);
+  // maps a run of points to window positions in one batch
+  void mapPoints(const ChartPoint *source, int count, SDL_FPoint *target) const;
 
   void autoScaleX();
   void autoScaleY();
 
+  // fill decimatedPoints from data according to the decimation mode
+  DecimationMode decimation;
+  std::vector<ChartPoint> decimatedPoints;
+  void decimateM4();
+  void decimateM4Lod();
+  void decimateLttb(int threshold);
+
+  // points decoded from data's compressed history, drawn under the
+  // buffered points when the x-axis reaches back to them
+  std::vector<ChartPoint> historyPoints;
+  void drawHistory();
+
+  // window positions of the points to draw, passed to drawPolyline
+  std::vector<SDL_FPoint> screenPoints;
+
+  // the grid and labels (under the data) and the zero line and border (over
+  // it) are drawn once into layers at (layerX, layerY), and redrawn only
+  // when the layout changes; without render targets they are drawn
+  // directly, and layersFailed stops them being asked for again
+  SDL_Texture *gridLayer;
+  SDL_Texture *frameLayer;
+  int layerX;
+  int layerY;
+  int layerW;
+  int layerH;
+  bool layersDirty;
+  bool layersFailed;
+  void drawGrid();
+  void drawFrame();
+  void renderLayers();
+
   AutoScaleMode scaleModesX;
   AutoScaleMode scaleModesY;
 
+  // draws the buffered points, decimated according to the mode unless
+  // decimate is false
+  void drawData(bool decimate = true);
+
+  // scrolling mode: the data is kept in scrollLayer, a ring of columns
+  // wider than the chart by scrollMargin. A column's position in the ring
+  // is x * scrollXScale - scrollXOrigin, modulo its width; y is mapped as
+  // when the ring was last drawn in full. Each frame erases the columns
+  // scrolling into view and draws only the segments after scrollLast.
+  bool scrolling;
+  SDL_Texture *scrollLayer;
+  bool scrollValid;
+  double scrollXScale;
+  double scrollXOrigin;
+  double scrollYScale;
+  double scrollYOffset;
+  double scrollFront; // ring position of the right edge of the chart
+  ChartPoint scrollLast;
+  static const int scrollMargin = 16;
+  // false if the chart can't scroll this frame, and must draw the data
+  // directly
+  bool drawScrolling();
+  void redrawScrollLayer();
+  void drawScrollSegments(int first, int end);
+
+  // what the last draw showed: the data's revision, and whether anything
+  // else that changes the picture has been set since
+  unsigned long drawnRevision;
+  bool viewDirty;
+
 public:
-  LineChart(GraphicsTools::Window *parent, DataSet *data, int drawX, int drawY,
-            int width, int height);
+  LineChart(GraphicsTools::Window *parent, PointSource *data, int drawX,
+            int drawY, int width, int height);
   ~LineChart();
   void draw();
   void setAxes(double xMin, double xMax, double yMin, double yMax);
+  // y-axis labels are drawn with the font while they are on; setting a
+  // font turns them on
   void setLabelFont(GraphicsTools::Font *f);
-  void setLabels(bool labelsOn) { showLabels = labelsOn; };
+  void setLabels(bool labelsOn) {
+    showLabels = labelsOn;
+    layersDirty = true;
+    viewDirty = true;
+  };
   void setGrid(double xInt, double xOff, double yInt, double yOff);
+  // which ends of each axis follow the data on every draw; the others stay
+  // where setAxes put them. Both are NONE until set.
   void setScaleModes(AutoScaleMode x, AutoScaleMode y);
+  void setDecimation(DecimationMode mode) {
+    decimation = mode;
+    viewDirty = true;
+  };
+  // For strip charts whose x-axis follows the newest point, as with
+  // addPoint2 and autoscaling: the plotted data is kept in a layer, and
+  // each draw shifts it by the x-advance and draws only the new segments,
+  // so the cost of a frame doesn't grow with the number of points shown.
+  // Everything is redrawn when the y-axis or the x scale changes or the
+  // data is not simply appended to. Without layers, draws as usual. The
+  // layer always holds every point, since new segments can't be decimated
+  // consistently with the rest, so the decimation mode only applies to the
+  // frames drawn without it.
+  void setScrolling(bool on) {
+    scrolling = on;
+    scrollValid = false;
+    viewDirty = true;
+  };
+  // whether draw() would show something different from the last time:
+  // points were added or queued, or the axes or settings changed
+  bool needsRedraw() const {
+    return viewDirty || data->getRevision() != drawnRevision ||
+           data->pendingPoints() > 0;
+  };
+};
+
+// A scrolling grid of values, such as a spectrogram: each column added
+// becomes the rightmost one and the oldest scrolls off the left. Columns
+// are written once into a ring of texture columns and drawn from there, so
+// a frame costs one texture update per new column and two copies, however
+// many cells there are. Values are coloured through a 256-entry map. If
+// the window can't stream textures, cells are drawn as rectangles.
+class HeatmapChart {
+private:
+  GraphicsTools::Window *parentWindow;
+  int drawPosX;
+  int drawPosY;
+  int drawWidth;
+  int drawHeight;
+
+  int columns;
+  int rows;
+  SDL_Texture *texture; // columns x rows; column i holds ring slot i
+  int nextColumn;       // the slot the next column goes to
+  int filledColumns;
+
+  double valueMin;
+  double valueMax;
+  Uint32 colorMap[256]; // ARGB8888
+  std::vector<Uint32> columnPixels;
+  // without a texture, the colour map indices of the ring, column by
+  // column, drawn as rectangles
+  std::vector<Uint8> cells;
+  void drawCells(int firstSlot, int count, int x);
+
+public:
+  HeatmapChart(GraphicsTools::Window *parent, int columns, int rows,
+               int drawX, int drawY, int width, int height);
+  ~HeatmapChart();
+  // values from min to max span the colour map; others are clamped
+  void setRange(double min, double max);
+  // a map blended from low to high
+  void setColorMap(GraphicsTools::ColorRgba low, GraphicsTools::ColorRgba high);
+  // a map running through the hues from lowHue to highHue, in degrees (the
+  // default goes from blue at 240 to red at 0)
+  void setHueColorMap(double lowHue, double highHue, double saturation = 1,
+                      double value = 1);
+  // rows values, bottom row first
+  void addColumn(const double *values);
+  void clear();
+  void draw();
+};
+
+// Draws many charts into one window, each cached in a render-target panel
+// and redrawn only when it needsRedraw(). With a frame budget, draw()
+// stops redrawing charts once the budget is spent, taking them in order of
+// priority; a deferred chart keeps showing its last picture, and gains a
+// point of priority for each frame it waits, so none is starved. Charts
+// that can't be cached (the window has no layers) are drawn every frame.
+class Dashboard {
+private:
+  struct Panel {
+    LineChart *chart;
+    int x;
+    int y;
+    int w;
+    int h;
+    int priority;
+    int waited; // frames deferred since the chart became dirty
+    SDL_Texture *texture; // NULL if drawn directly
+    bool drawn;
+  };
+  GraphicsTools::Window *parentWindow;
+  std::vector<Panel> panels;
+  double frameBudget;
+  int deferredCount;
+
+public:
+  Dashboard(GraphicsTools::Window *parent);
+  ~Dashboard(); // deletes the charts
+  // Takes ownership of a chart of the dashboard's window, shown in the
+  // panel at (x, y) of size w by h, which should cover its labels and
+  // border. Higher priorities are redrawn first.
+  void addChart(LineChart *chart, int x, int y, int w, int h,
+                int priority = 0);
+  // seconds draw() may spend redrawing charts (0, the default, is no limit)
+  void setFrameBudget(double seconds) { frameBudget = seconds; };
+  // makes every chart redraw on the next draw()
+  void invalidate();
+  // some chart has changed since it was last drawn, so a window in
+  // OnDemand mode should be asked for a frame
+  bool needsRedraw() const;
+  // redraws the dirty charts within the budget, then draws every panel
+  void draw();
+  int deferred() const { return deferredCount; }; // charts left stale
 };
 
 } // namespace ChartTools
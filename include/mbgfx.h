@@ -5,7 +5,13 @@
 #ifndef IMAGES_H
 #define IMAGES_H
 
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "SDL2/SDL.h"
 #include "SDL2/SDL_image.h"
@@ -13,14 +19,41 @@
 
 namespace GraphicsTools {
 
-// library initialization
-int InitGraphics();
+// library initialization; headless initialization skips the video
+// subsystem, so only Offscreen windows can be used
+int InitGraphics(bool headless = false);
 int InitText();
 int CloseGraphics();
 int CloseText();
 
 enum TextAlignModeH { Left, Center, Right };
 
+// Onscreen windows are shown and drawn with an accelerated renderer,
+// vsynced unless setPresentMode says otherwise. Offscreen windows need no
+// display: they draw with the software renderer into a framebuffer surface
+// and never wait for vsync.
+enum WindowMode { Onscreen, Offscreen };
+
+// How a window paces its frames (see Window::setPresentMode). VSync
+// presents at the display rate; Uncapped as fast as frames are drawn;
+// FixedRate at a set number of frames per second; OnDemand synced to the
+// display like VSync, but only the frames that were requested.
+enum PresentMode { VSync, Uncapped, FixedRate, OnDemand };
+
+// The SdlRenderer backend passes each drawing call to the SDL renderer.
+// The TiledRaster backend records the calls, rasterizes them in update()
+// into a CPU framebuffer, in tiles spread over a pool of threads, and
+// uploads the result as one texture. Its shapes are anti-aliased and it has
+// no layers: createLayer returns NULL.
+enum RenderBackend { SdlRenderer, TiledRaster };
+
+class TileRasterizer;
+struct RasterImage;
+class FrameRecorder;
+class ImageLoader;
+// the capture formats are listed in mbcapture.h
+enum CaptureFormat : int;
+
 // library-independent colors
 // adapted from https://stackoverflow.com/questions/3018313/
 struct ColorRgba {
@@ -35,37 +68,182 @@ struct ColorHsv {
   double v; // a fraction between 0 and 1
 };
 
+// a colour as the renderer takes it: one byte per channel, on the 0-255
+// scale the drawing functions use. ColorRgba converts to it implicitly,
+// clamping each channel and dropping fractions, and at compile time when
+// the colour is a constant.
+struct ColorRgba8 {
+  Uint8 r;
+  Uint8 g;
+  Uint8 b;
+  Uint8 a;
+
+  constexpr ColorRgba8() : r(0), g(0), b(0), a(0) {}
+  constexpr ColorRgba8(double red, double green, double blue,
+                       double alpha = 255)
+      : r(channel(red)), g(channel(green)), b(channel(blue)),
+        a(channel(alpha)) {}
+  constexpr ColorRgba8(ColorRgba c) : ColorRgba8(c.r, c.g, c.b, c.a) {}
+
+  constexpr ColorRgba rgba() const {
+    return {(double)r, (double)g, (double)b, (double)a};
+  }
+  // as an ARGB8888 pixel, and back
+  constexpr Uint32 argb() const {
+    return ((Uint32)a << 24) | ((Uint32)r << 16) | ((Uint32)g << 8) | b;
+  }
+  static constexpr ColorRgba8 fromArgb(Uint32 pixel) {
+    return ColorRgba8((pixel >> 16) & 0xFF, (pixel >> 8) & 0xFF, pixel & 0xFF,
+                      pixel >> 24);
+  }
+  constexpr bool operator==(ColorRgba8 o) const {
+    return r == o.r && g == o.g && b == o.b && a == o.a;
+  }
+  constexpr bool operator!=(ColorRgba8 o) const { return !(*this == o); }
+
+private:
+  static constexpr Uint8 channel(double v) {
+    return (v > 0) ? ((v < 255) ? (Uint8)v : 255) : 0;
+  }
+};
+
 namespace Colors {
-const ColorRgba Black = {0, 0, 0, 255};
-const ColorRgba Grey25 = {64, 64, 64, 255};
-const ColorRgba Grey = {192, 192, 192, 255};
-const ColorRgba White = {255, 255, 255, 255};
-const ColorRgba Red = {255, 0, 0, 255};
-const ColorRgba Blue = {0, 0, 255, 255};
-const ColorRgba Green = {0, 255, 0, 255};
-const ColorRgba Yellow = {255, 255, 0, 255};
+constexpr ColorRgba Black = {0, 0, 0, 255};
+constexpr ColorRgba Grey25 = {64, 64, 64, 255};
+constexpr ColorRgba Grey = {192, 192, 192, 255};
+constexpr ColorRgba White = {255, 255, 255, 255};
+constexpr ColorRgba Red = {255, 0, 0, 255};
+constexpr ColorRgba Blue = {0, 0, 255, 255};
+constexpr ColorRgba Green = {0, 255, 0, 255};
+constexpr ColorRgba Yellow = {255, 255, 0, 255};
 } // namespace Colors
 
 // color operations
 ColorRgba blend(ColorRgba c1, double w1, ColorRgba c2, double w2);
 ColorRgba randomColor();
 ColorRgba hsv2rgb(ColorHsv in);
+// the same over arrays, several colours at a time where SIMD is available.
+// blend takes non-negative weights; out may be c1 or c2. hsv2rgb gives
+// opaque colours on the 0-255 scale. Both are within one step of the
+// scalar results (bench checks this).
+void blend(const ColorRgba8 *c1, double w1, const ColorRgba8 *c2, double w2,
+           ColorRgba8 *out, int count);
+void hsv2rgb(const ColorHsv *in, ColorRgba8 *out, int count);
 
 class Font {
 private:
   int size;
   std::string filename;
   TTF_Font *f;
+  unsigned int _id; // unique per Font, so caches never confuse two fonts
 
 public:
   Font(const char *file, int displaySize); // size in points
   ~Font();
   TTF_Font *font() const { return f; };
+  unsigned int id() const { return _id; };
+};
+
+// render activity of one frame. Collected only when the library is built
+// with MBGFX_STATS defined (make STATS=1); otherwise every field stays zero
+// and collection costs nothing.
+struct RenderStats {
+  // SDL calls by kind
+  int lines;           // SDL_RenderDrawLine
+  int fillRects;       // SDL_RenderFillRect
+  int geometry;        // SDL_RenderGeometry
+  int renderCopies;    // SDL_RenderCopy
+  int colorChanges;    // SDL_SetRenderDrawColor
+  int textureCreates;  // textures created while drawing
+  int textureDestroys; // by the caches, destroyLayer and releaseImage
+  int textRasterizations;
+
+  // seconds spent in each drawing function, including any it calls
+  double drawRectangleTime;
+  double drawCircleTime;
+  double drawCircleGradientTime;
+  double drawTextTime;
+  double drawLineTime;
+  double drawPolylineTime;
+  double drawImageTime;
+  double drawLayerTime;
+};
+
+// distribution of frame times in bins of binWidth seconds; longer times
+// count in the last bin
+class FrameHistogram {
+public:
+  static const int binCount = 256;
+  static constexpr double binWidth = 0.00025; // up to 64 ms
+
+  FrameHistogram() { reset(); };
+  void add(double seconds);
+  void reset();
+  int count() const { return total; };
+  int bin(int i) const { return bins[i]; };
+  double mean() const { return total > 0 ? sum / total : 0; };
+  double max() const { return longest; };
+  // the upper edge of the bin that holds the fraction p of the frames,
+  // shortest first (0 if there are none)
+  double percentile(double p) const;
+
+private:
+  int bins[binCount];
+  int total;
+  double sum;
+  double longest;
+};
+
+// a texture kept between draws, with its size
+struct CachedTexture {
+  SDL_Texture *texture;
+  int w;
+  int h;
+  int pins; // see TextureCache::pin
+};
+
+// least-recently-used set of textures, keyed by string and bounded by the
+// bytes of texture memory they hold; the cache owns (destroys) them
+class TextureCache {
+public:
+  TextureCache(size_t byteBudget);
+  ~TextureCache();
+
+  // returns NULL if absent; a hit becomes the most recently used entry
+  const CachedTexture *find(const std::string &key);
+  // takes ownership of the texture, evicting old entries to fit the budget
+  const CachedTexture *insert(const std::string &key, SDL_Texture *texture,
+                              int w, int h);
+  // a pinned entry is never evicted, though its bytes count against the
+  // budget; pins nest
+  void pin(const std::string &key);
+  void unpin(const std::string &key);
+  void setBudget(size_t byteBudget);
+  void clear();
+  // textures destroyed so far, by eviction or clearing
+  int destroyed() const { return destroyedCount; };
+  // called with each texture just before it is destroyed
+  void setDestroyCallback(std::function<void(SDL_Texture *)> callback) {
+    destroyCallback = callback;
+  };
+
+private:
+  size_t budget;
+  size_t used;
+  int destroyedCount;
+  std::function<void(SDL_Texture *)> destroyCallback;
+  std::list<std::pair<std::string, CachedTexture>> entries; // newest first
+  std::unordered_map<std::string,
+                     std::list<std::pair<std::string, CachedTexture>>::iterator>
+      index;
+  void evict(size_t bytes);
+  void destroy(const CachedTexture &entry);
 };
 
 class Window {
 public:
-  Window(std::string title, int width, int height);
+  Window(std::string title, int width, int height,
+         WindowMode mode = Onscreen, RenderBackend backend = SdlRenderer);
   ~Window();
 
   // getters
@@ -76,28 +254,200 @@ public:
   void clear();
   void update();
 
+  // export the current frame; raw frames are tightly packed RGBA8 rows.
+  // Offscreen windows write their framebuffer directly, onscreen windows
+  // read the frame back from the renderer first. SDL leaves the back buffer
+  // undefined once it is presented, so on an onscreen window (other than a
+  // TiledRaster one) call these after drawing a frame and before update().
+  // Returns 0 on success.
+  int savePNG(std::string filename);
+  int saveRaw(std::string filename);
+  // the framebuffer of an offscreen window (NULL if onscreen)
+  SDL_Surface *framebuffer() const { return surface; };
+
+  // recording: each update() from now on reads the frame into one of
+  // `buffers` pooled buffers, and a background thread writes it (see
+  // FrameRecorder). If the writer falls behind and no buffer is free, the
+  // frame is dropped rather than waited for. Returns 0 on success.
+  int startCapture(std::string path, CaptureFormat format, int buffers = 3);
+  // waits for the queued frames to be written
+  void stopCapture();
+  // frames written and dropped so far by the current recording
+  int capturedFrames() const;
+  int droppedFrames() const;
+
+  // statistics of the last frame, completed by update(); the callback, if
+  // set, is also given them there
+  const RenderStats &frameStats() const { return lastStats; };
+  void setStatsCallback(std::function<void(const RenderStats &)> callback) {
+    statsCallback = callback;
+  };
+
+  // Frame pacing. A frame loop calls waitFrame() before drawing each frame
+  // and update() after; loops that don't call waitFrame() are only paced
+  // by vsync. FixedRate frames start fps times a second: waitFrame()
+  // sleeps until shortly before the next start and spins for the rest, and
+  // a loop that falls more than a frame behind starts again from the
+  // present rather than catching up. Offscreen windows have no display, so
+  // VSync and OnDemand don't wait for one. Returns 0 on success; if the
+  // renderer can't change vsync, the mode is still set.
+  int setPresentMode(PresentMode mode, double fps = 60);
+  PresentMode presentMode() const { return pacing; };
+  // asks for a frame in OnDemand mode; may be called from any thread
+  void requestFrame() { frameRequested = true; };
+  // waits until the next frame is due and returns true. In OnDemand mode
+  // that is once a frame is requested; instead it returns false when an
+  // event is pending, for the loop to handle, or after timeoutMs.
+  bool waitFrame(int timeoutMs = 100);
+  // the time between presented frames, and the part of it from
+  // waitFrame() returning until the frame was presented
+  const FrameHistogram &frameIntervals() const { return intervals; };
+  const FrameHistogram &frameWorkTimes() const { return workTimes; };
+  void resetFrameTimes();
+
   // drawing functions
-  void drawRectangle(GraphicsTools::ColorRgba color, int x, int y, int w,
+  void drawRectangle(GraphicsTools::ColorRgba8 color, int x, int y, int w,
                      int h); // (x,y) is upper-left corner
-  void drawCircle(GraphicsTools::ColorRgba, int x, int y, int r);
-  void drawCircleGradient(GraphicsTools::ColorRgba outer,
-                          GraphicsTools::ColorRgba inner, int x, int y, int r);
+  void drawCircle(GraphicsTools::ColorRgba8, int x, int y, int r);
+  void drawCircleGradient(GraphicsTools::ColorRgba8 outer,
+                          GraphicsTools::ColorRgba8 inner, int x, int y, int r);
   void drawText(std::string str, GraphicsTools::Font *font,
-                GraphicsTools::ColorRgba, int x, int y,
+                GraphicsTools::ColorRgba8, int x, int y,
                 GraphicsTools::TextAlignModeH align =
                     GraphicsTools::TextAlignModeH::Left);
-  void drawLine(GraphicsTools::ColorRgba color, int thickness, int x1, int y1,
+  void drawLine(GraphicsTools::ColorRgba8 color, int thickness, int x1, int y1,
                 int x2, int y2);
+  // draws connected segments through the points as batches of triangles
+  void drawPolyline(GraphicsTools::ColorRgba8 color, int thickness,
+                    const SDL_FPoint *points, int count);
+
+  // size of a string as drawText would draw it
+  void textSize(std::string str, GraphicsTools::Font *font, int *w, int *h);
 
-  // load, then draw to show an image
+  // offscreen layers: between beginLayer and endLayer, drawing goes to the
+  // layer, with window position (x,y) at its top-left. Layers can nest.
+  // createLayer returns NULL if the renderer has no render targets, as with
+  // the TiledRaster backend; the caller destroys the texture with
+  // destroyLayer, which ignores NULL. beginLayer clears the layer unless
+  // told to keep what it holds, and eraseRectangle makes part of the layer
+  // transparent again.
+  SDL_Texture *createLayer(int w, int h);
+  void destroyLayer(SDL_Texture *layer);
+  void beginLayer(SDL_Texture *layer, int x, int y, bool clear = true);
+  void eraseRectangle(int x, int y, int w, int h);
+  void endLayer();
+  void drawLayer(SDL_Texture *layer, int x, int y);
+
+  // Images are cached by filename, so loading one again returns the same
+  // texture. The window owns the texture: give it back with releaseImage
+  // rather than destroying it. Released images stay cached, within the
+  // budget (64 MB by default), until evicted. Files are decoded once for
+  // all windows, on a background thread (see ImageLoader); loadImage waits
+  // for the decode, unless preloadImage started it early enough.
   SDL_Texture *loadImage(std::string filename);
+  void releaseImage(SDL_Texture *img);
+  // starts decoding the file; update() uploads it once decoded, so a
+  // later loadImage finds it ready
+  void preloadImage(std::string filename);
+  void setImageCacheBudget(size_t bytes) { imageCache.setBudget(bytes); };
   void drawImage(SDL_Texture *, int, int, int);
+  // a texture of w x h ARGB8888 pixels for the caller to write with
+  // SDL_UpdateTexture, and to destroy with destroyLayer; NULL with the
+  // TiledRaster backend
+  SDL_Texture *createStreamingImage(int w, int h);
+  // draws the part src of a texture, scaled to fill dst
+  void drawImageRegion(SDL_Texture *img, SDL_Rect src, SDL_Rect dst);
 
 private:
   SDL_Renderer *ren;
   std::string name;
   int _height, _width;
   SDL_Window *win;
+  SDL_Surface *surface; // offscreen framebuffer
+
+  // the frame as an RGBA8 surface; *owned is set if the caller must free it
+  SDL_Surface *frameSurface(bool *owned);
+  // copies the frame as RGBA8 into pixels; returns 0 on success. Onscreen,
+  // it reads the back buffer, so it must run before SDL_RenderPresent
+  int readFrame(void *pixels, int pitch);
+
+  FrameRecorder *recorder;
+  int frameNumber; // frames updated since the recording started
+
+  // drawing origin and the layers that are drawn into
+  struct LayerState {
+    SDL_Texture *target;
+    int originX;
+    int originY;
+  };
+  int originX, originY;
+  std::vector<LayerState> layerStack;
+  // a layer records alpha, but the window ignores the alpha of solid
+  // shapes; draw them opaque into layers so both look the same
+  Uint8 shapeAlpha(Uint8 a) const { return layerStack.empty() ? a : 255; };
+
+  // the renderer's draw colour and blend mode as last set, so that setting
+  // them again to the same values costs no SDL call; drawColorSet is false
+  // until the colour is first set
+  ColorRgba8 drawColor;
+  bool drawColorSet;
+  SDL_BlendMode drawBlendMode;
+  void setDrawColor(ColorRgba8 color);
+  void setDrawBlendMode(SDL_BlendMode mode);
+
+  // rendered strings, keyed by font, colour and text
+  TextureCache textCache;
+  // rasterized circles, keyed by colours and radius
+  TextureCache spriteCache;
+  // loaded images, keyed by filename and pinned while loaded; the images
+  // being preloaded are uploaded by update() as they become ready
+  TextureCache imageCache;
+  std::unordered_map<SDL_Texture *, std::string> imageNames;
+  std::vector<std::string> preloads;
+  std::shared_ptr<ImageLoader> imageLoader;
+  const CachedTexture *uploadImage(const std::string &filename,
+                                  SDL_Surface *surf);
+  void uploadPreloads();
+  const CachedTexture *circleSprite(ColorRgba8 outer, ColorRgba8 inner, int r);
+  void drawCircleSprite(ColorRgba8 outer, ColorRgba8 inner, int x, int y,
+                        int r);
+
+  // frame pacing; the times are performance counter values, 0 if unset.
+  // nextFrame is when the next FixedRate frame starts.
+  PresentMode pacing;
+  Uint64 framePeriod;
+  Uint64 nextFrame;
+  Uint64 frameStart;
+  Uint64 lastPresent;
+  std::atomic<bool> frameRequested;
+  FrameHistogram intervals;
+  FrameHistogram workTimes;
+
+  // statistics of the frame in progress and the last completed one
+  RenderStats currentStats;
+  RenderStats lastStats;
+  int cacheDestroyed; // textures the caches had destroyed at the last update
+  std::function<void(const RenderStats &)> statsCallback;
+
+  // scratch buffers for drawPolyline, kept to avoid reallocating each call;
+  // a line is drawn in chunks of about this many vertices (5 per point)
+  static const size_t polylineChunkVertices = 5 * 1024;
+  std::vector<SDL_Vertex> polylineVertices;
+  std::vector<int> polylineIndices;
+
+  // TiledRaster backend: the rasterizer (NULL for SdlRenderer), the texture
+  // its frames are uploaded to, and the pixels of loaded images and of
+  // rendered strings, keyed like textCache. Image entries go when
+  // imageCache destroys their texture.
+  TileRasterizer *raster;
+  SDL_Texture *rasterTexture;
+  std::unordered_map<SDL_Texture *, std::shared_ptr<RasterImage>> rasterImages;
+  std::unordered_map<std::string, std::shared_ptr<RasterImage>> rasterText;
+  size_t rasterTextBytes;
+  void startRaster();
+  void drawRasterText(const std::string &key, const std::string &text,
+                      Font *font, SDL_Color color, int x, int y,
+                      TextAlignModeH al);
 };
 
 } // namespace GraphicsTools
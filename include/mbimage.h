@@ -0,0 +1,68 @@
+/* Background decoder for image files. Files are decoded into surfaces on
+    a worker thread, at most once while their surface is cached, so windows
+    only have to upload them as textures. */
+
+#ifndef IMAGE_LOADER_H
+#define IMAGE_LOADER_H
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "SDL2/SDL.h"
+
+namespace GraphicsTools {
+
+class ImageLoader {
+public:
+  // decoded surfaces no window has taken yet are always kept; taken ones
+  // are kept, least recently used first out, within byteBudget bytes
+  ImageLoader(size_t byteBudget);
+  // abandons the decodes still queued
+  ~ImageLoader();
+
+  // the loader of the windows alive, created by the first one to ask
+  static std::shared_ptr<ImageLoader> shared();
+
+  // queues the file for decoding unless it is decoded or queued already
+  void request(const std::string &filename);
+  // the decoded surface, requesting it first if needed. Without wait,
+  // returns NULL while it is queued. Returns NULL and sets *failed if the
+  // file could not be decoded; the next request tries again.
+  std::shared_ptr<SDL_Surface> take(const std::string &filename, bool wait,
+                                    bool *failed);
+
+  int decoded() const;
+
+private:
+  enum State { Queued, Ready, Failed };
+  struct Entry {
+    State state;
+    bool taken;
+    std::shared_ptr<SDL_Surface> surface;
+    std::list<std::string>::iterator age; // in takenOrder once taken
+  };
+  std::unordered_map<std::string, Entry> entries;
+  std::deque<std::string> queue;
+  std::list<std::string> takenOrder; // most recently taken first
+  size_t budget;
+  size_t takenBytes;
+  int decodedCount;
+  bool stopping;
+  mutable std::mutex mutex;
+  std::condition_variable queued;
+  std::condition_variable done;
+  std::thread worker;
+
+  void workerLoop();
+  void trim();
+};
+
+} // namespace GraphicsTools
+
+#endif
@@ -0,0 +1,102 @@
+/* A multithreaded tiled software rasterizer, the CPU backend of
+    GraphicsTools::Window. Drawing calls are recorded as commands;
+    render() bins them to tiles and rasterizes the tiles on a pool
+    of threads into an ARGB8888 framebuffer. */
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "SDL2/SDL.h"
+
+namespace GraphicsTools {
+
+// an image to blit: ARGB8888 pixels with straight alpha, rows packed
+struct RasterImage {
+  int w;
+  int h;
+  std::vector<Uint32> pixels;
+};
+
+// converts a surface of any format; returns NULL on failure
+std::shared_ptr<RasterImage> MakeRasterImage(SDL_Surface *surface);
+
+class TileRasterizer {
+public:
+  // threads <= 0 uses one thread per hardware thread
+  TileRasterizer(int width, int height, int threads = 0);
+  ~TileRasterizer();
+
+  // Recording. Shapes are opaque and anti-aliased at their edges; the alpha
+  // of their colours is ignored, as on the window. Nothing is drawn until
+  // render().
+  void clear(SDL_Color color);
+  void fillRect(SDL_Color color, int x, int y, int w, int h);
+  // a segment with round caps, so consecutive segments join smoothly
+  void drawLine(SDL_Color color, float thickness, float x1, float y1,
+                float x2, float y2);
+  // colours are blended from inner at the centre to outer at the edge
+  void drawCircle(SDL_Color outer, SDL_Color inner, float x, float y,
+                  float r);
+  void drawImage(std::shared_ptr<const RasterImage> image, int x, int y,
+                 int alpha);
+
+  // rasterizes the commands recorded since the last render, then forgets
+  // them; the framebuffer keeps its contents
+  void render();
+
+  const Uint32 *pixels() const { return framebuffer.data(); };
+  int pitch() const { return width * 4; };
+  int threadCount() const { return workers.size() + 1; };
+
+private:
+  enum CommandType { Fill, Line, Circle, Image };
+  struct Command {
+    CommandType type;
+    Uint32 color;
+    Uint32 color2;   // inner colour of a circle
+    float x0, y0;    // fill: top-left; line: first end; circle: centre
+    float x1, y1;    // fill: bottom-right (exclusive); line: second end
+    float size;      // line: half the thickness; circle: radius
+    int image;       // index into images; alpha in color
+    int minX, minY, maxX, maxY; // pixel bounds, inclusive
+  };
+
+  int width, height;
+  int tilesX, tilesY;
+  std::vector<Uint32> framebuffer;
+  std::vector<Command> commands;
+  std::vector<std::shared_ptr<const RasterImage>> images;
+  std::vector<std::vector<int>> tileCommands;
+
+  void record(Command &command);
+  void renderTile(int tile);
+  void fillTile(const Command &c, int x0, int y0, int x1, int y1);
+  void lineTile(const Command &c, int x0, int y0, int x1, int y1);
+  void circleTile(const Command &c, int x0, int y0, int x1, int y1);
+  void imageTile(const Command &c, int x0, int y0, int x1, int y1);
+
+  // the pool: render() bumps generation to wake the workers, then all of
+  // them, and the calling thread, take tiles from nextTile until none are
+  // left
+  std::vector<std::thread> workers;
+  std::mutex poolMutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+  unsigned long generation;
+  int activeWorkers;
+  bool stopping;
+  std::atomic<int> nextTile;
+  void workerLoop();
+  void runTiles();
+};
+
+} // namespace GraphicsTools
+
+#endif
@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+#include "SDL2/SDL_image.h"
+#include "mbcapture.h"
+
+using std::cerr;
+
+namespace GraphicsTools {
+
+// splits a PNG name pattern around its frame number, which must be the one
+// conversion in it: %d or %i, optionally zero-padded to a width of at most
+// 64 (%05d); "%%" stands for a literal percent sign
+static bool splitPattern(const std::string &pattern, std::string *prefix,
+                         std::string *suffix, bool *zeroPad, int *width) {
+  int conversions = 0;
+  std::string *part = prefix;
+  for (size_t i = 0; i < pattern.size(); i++) {
+    if (pattern[i] != '%') {
+      *part += pattern[i];
+      continue;
+    }
+    if (++i < pattern.size() && pattern[i] == '%') {
+      *part += '%';
+      continue;
+    }
+    *zeroPad = i < pattern.size() && pattern[i] == '0';
+    *width = 0;
+    while (i < pattern.size() && pattern[i] >= '0' && pattern[i] <= '9' &&
+           *width <= 64) {
+      *width = *width * 10 + (pattern[i++] - '0');
+    }
+    if (*width > 64 || i >= pattern.size() ||
+        (pattern[i] != 'd' && pattern[i] != 'i')) {
+      return false;
+    }
+    conversions++;
+    part = suffix;
+  }
+  return conversions == 1;
+}
+
+FrameRecorder::FrameRecorder(std::string p, CaptureFormat f, int w, int h,
+                             int buffers)
+    : path(p), format(f), width(w), height(h), writtenCount(0),
+      droppedCount(0), failedCount(0), stopping(false), rawFile(NULL),
+      patternValid(false), zeroPad(false), numberWidth(0) {
+  if (format == CaptureRaw) {
+    rawFile = fopen(path.c_str(), "wb");
+    if (rawFile == NULL) {
+      cerr << "cannot open " << path << "\n";
+    }
+  } else {
+    patternValid = splitPattern(path, &namePrefix, &nameSuffix, &zeroPad,
+                                &numberWidth);
+    if (!patternValid) {
+      cerr << "capture pattern needs exactly one %d: " << path << "\n";
+    }
+  }
+  // all buffers are allocated up front, so recording never allocates
+  storage.resize(std::max(buffers, 1));
+  for (auto &buffer : storage) {
+    buffer.resize((size_t)width * height * 4);
+    freeBuffers.push_back(buffer.data());
+  }
+  worker = std::thread(&FrameRecorder::workerLoop, this);
+}
+
+FrameRecorder::~FrameRecorder() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  ready.notify_one();
+  worker.join();
+  if (rawFile != NULL) {
+    fclose(rawFile);
+  }
+}
+
+Uint8 *FrameRecorder::acquire() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (freeBuffers.empty()) {
+    droppedCount++;
+    return NULL;
+  }
+  Uint8 *buffer = freeBuffers.back();
+  freeBuffers.pop_back();
+  return buffer;
+}
+
+void FrameRecorder::submit(Uint8 *frame, int frameNumber) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back({frame, frameNumber});
+  }
+  ready.notify_one();
+}
+
+void FrameRecorder::release(Uint8 *frame) {
+  std::lock_guard<std::mutex> lock(mutex);
+  freeBuffers.push_back(frame);
+}
+
+int FrameRecorder::written() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return writtenCount;
+}
+
+int FrameRecorder::dropped() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return droppedCount;
+}
+
+int FrameRecorder::failed() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return failedCount;
+}
+
+void FrameRecorder::workerLoop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    ready.wait(lock, [this] { return stopping || !queue.empty(); });
+    if (queue.empty()) {
+      return; // stopping, and everything is written
+    }
+    QueuedFrame frame = queue.front();
+    queue.pop_front();
+    lock.unlock();
+    bool ok = write(frame);
+    lock.lock();
+    freeBuffers.push_back(frame.pixels);
+    if (ok) {
+      writtenCount++;
+    } else {
+      failedCount++;
+    }
+  }
+}
+
+bool FrameRecorder::write(const QueuedFrame &frame) {
+  if (format == CaptureRaw) {
+    size_t bytes = (size_t)width * height * 4;
+    return rawFile != NULL && fwrite(frame.pixels, 1, bytes, rawFile) == bytes;
+  }
+
+  // the pattern is never used as a format string
+  char number[128];
+  snprintf(number, sizeof(number), zeroPad ? "%0*d" : "%*d", numberWidth,
+           frame.number);
+  std::string filename = namePrefix + number + nameSuffix;
+  SDL_Surface *surf = SDL_CreateRGBSurfaceWithFormatFrom(
+      frame.pixels, width, height, 32, width * 4, SDL_PIXELFORMAT_RGBA32);
+  if (surf == NULL) {
+    cerr << "cannot capture frame: " << SDL_GetError() << "\n";
+    return false;
+  }
+  int result = IMG_SavePNG(surf, filename.c_str());
+  if (result != 0) {
+    cerr << "cannot save " << filename << ": " << SDL_GetError() << "\n";
+  }
+  SDL_FreeSurface(surf);
+  return result == 0;
+}
+
+} // namespace GraphicsTools
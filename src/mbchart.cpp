@@ -1,6 +1,23 @@
 #include "mbchart.h"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <cmath>
+#include <limits>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace ChartTools {
 
@@ -14,53 +31,303 @@ namespace ChartTools {
     ChartPoint::ChartPoint(double xVal, double yVal) :
         x (xVal), y (yVal) {}
 
+    PointQueue::PointQueue(int minCapacity) :
+        capacity (1), readPos (0), writePos (0) {
+        while (capacity < minCapacity){
+            capacity *= 2;
+        }
+        slots = new QueuedPoint[capacity];
+    }
+
+    PointQueue::~PointQueue(){
+        delete[] slots;
+    }
+
+    bool PointQueue::push(const QueuedPoint& p){
+        unsigned int write = writePos.load(std::memory_order_relaxed);
+        unsigned int read = readPos.load(std::memory_order_acquire);
+        if (write - read == (unsigned int)capacity){
+            return false;
+        }
+        slots[write & (capacity - 1)] = p;
+        writePos.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    int PointQueue::size() const {
+        unsigned int read = readPos.load(std::memory_order_relaxed);
+        unsigned int write = writePos.load(std::memory_order_acquire);
+        return write - read;
+    }
+
+    int PointQueue::pop(QueuedPoint* out, int maxCount){
+        unsigned int read = readPos.load(std::memory_order_relaxed);
+        unsigned int write = writePos.load(std::memory_order_acquire);
+        int count = std::min((int)(write - read), maxCount);
+        for (int i = 0; i < count; i++){
+            out[i] = slots[(read + i) & (capacity - 1)];
+        }
+        readPos.store(read + count, std::memory_order_release);
+        return count;
+    }
+
     DataSet::DataSet(int setSize) :
-        currentSize (0), maxSize (setSize) {
+        maxSize (setSize), currentSize (0), totalPoints (0), head (0), ownsPoints (true),
+        revision (0), sumY (NULL), sumY2 (NULL), emaAlpha (0), emaValue (0),
+        quantileWindow (0), quantileGamma (1), zeroCount (0), history (NULL) {
         points = new ChartPoint[maxSize];
     }
 
+    DataSet::DataSet(const ChartPoint* external, int count, ChartPoint lowest, ChartPoint highest) :
+        maxSize (count), currentSize (count), totalPoints (count), head (0), ownsPoints (false),
+        revision (0), sumY (NULL), sumY2 (NULL), emaAlpha (0), emaValue (0),
+        quantileWindow (0), quantileGamma (1), zeroCount (0), history (NULL) {
+        // never written through, as addPoint and clear leave views alone
+        points = const_cast<ChartPoint*>(external);
+        // nothing is evicted from a view, so each extremum is its only
+        // candidate for good
+        if (count > 0){
+            minXQueue.push_back(ExtremumCandidate({0, lowest.x}));
+            maxXQueue.push_back(ExtremumCandidate({0, highest.x}));
+            minYQueue.push_back(ExtremumCandidate({0, lowest.y}));
+            maxYQueue.push_back(ExtremumCandidate({0, highest.y}));
+        }
+    }
+
+    DataSet::DataSet(const ChartPoint* external, int count) :
+        DataSet(external, count, ChartPoint(), ChartPoint()) {
+        for (int i = 0; i < count; i++){
+            const ChartPoint& p = external[i];
+            if (i == 0 || p.x < minXQueue.front().value){
+                minXQueue.front().value = p.x;
+            }
+            if (i == 0 || p.x > maxXQueue.front().value){
+                maxXQueue.front().value = p.x;
+            }
+            if (i == 0 || p.y < minYQueue.front().value){
+                minYQueue.front().value = p.y;
+            }
+            if (i == 0 || p.y > maxYQueue.front().value){
+                maxYQueue.front().value = p.y;
+            }
+        }
+    }
+
     DataSet::~DataSet(){
-        delete points;
+        if (ownsPoints){
+            delete[] points;
+        }
+        delete[] sumY;
+        delete[] sumY2;
+        delete history;
     }
 
-    void DataSet::addPoint(double x, double y){
-        if (currentSize < maxSize){
-            points[currentSize] = ChartPoint(x, y);
-            currentSize++;
-            totalPoints++;
+    template <typename Set>
+    RollingPointSource<Set>::RollingPointSource() :
+        ingest (NULL) {
+    }
+
+    template <typename Set>
+    RollingPointSource<Set>::~RollingPointSource(){
+        delete ingest;
+    }
+
+    template <typename Set>
+    void RollingPointSource<Set>::enableQueue(int capacity){
+        if (ingest == NULL){
+            ingest = new PointQueue(capacity);
         }
-        else {
-            for (int i = 1; i < maxSize; i++){ // start at 1, since comparing to prev
-                points[i-1] = points[i];
+    }
+
+    template <typename Set>
+    bool RollingPointSource<Set>::queuePoint(double x, double y){
+        return ingest != NULL && ingest->push(QueuedPoint({x, y, false}));
+    }
+
+    template <typename Set>
+    bool RollingPointSource<Set>::queuePoint2(double y){
+        return ingest != NULL && ingest->push(QueuedPoint({0, y, true}));
+    }
+
+    template <typename Set>
+    int RollingPointSource<Set>::drainQueue(){
+        if (ingest == NULL){
+            return 0;
+        }
+        Set& set = static_cast<Set&>(*this);
+        // take at most one queue's worth, so a fast producer can't keep
+        // the consumer here indefinitely
+        QueuedPoint batch[256];
+        int added = 0;
+        while (added < ingest->getCapacity()){
+            int count = ingest->pop(batch, std::min(256, ingest->getCapacity() - added));
+            for (int i = 0; i < count; i++){
+                if (batch[i].continuous){
+                    set.addPoint2(batch[i].y);
+                }
+                else {
+                    set.addPoint(batch[i].x, batch[i].y);
+                }
+            }
+            added += count;
+            if (count == 0){
+                break;
             }
-            points[currentSize] = ChartPoint(x, y);
-            totalPoints++;
         }
+        return added;
     }
 
-    void DataSet::addPoint2(double y){
+    // drops candidates that are no longer in the window, then the ones the
+    // new value supersedes, so each point enters and leaves a queue once
+    static void pushCandidate(std::deque<ExtremumCandidate>& queue, int oldestSeq,
+                              int seq, double value, bool isMax){
+        while (!queue.empty() && queue.front().seq < oldestSeq){
+            queue.pop_front();
+        }
+        while (!queue.empty() && (isMax ? queue.back().value <= value
+                                        : queue.back().value >= value)){
+            queue.pop_back();
+        }
+        queue.push_back(ExtremumCandidate({seq, value}));
+    }
+
+    template <typename Set>
+    void RollingPointSource<Set>::pushExtremaX(int oldestSeq, int seq, double x){
+        pushCandidate(minXQueue, oldestSeq, seq, x, false);
+        pushCandidate(maxXQueue, oldestSeq, seq, x, true);
+    }
+
+    template <typename Set>
+    void RollingPointSource<Set>::pushExtremaY(int oldestSeq, int seq, double y){
+        pushCandidate(minYQueue, oldestSeq, seq, y, false);
+        pushCandidate(maxYQueue, oldestSeq, seq, y, true);
+    }
+
+    template <typename Set>
+    void RollingPointSource<Set>::clearExtrema(){
+        minXQueue.clear();
+        maxXQueue.clear();
+        minYQueue.clear();
+        maxYQueue.clear();
+    }
+
+    template <typename Set>
+    double RollingPointSource<Set>::minX() const {
+        return minXQueue.empty() ? 0 : minXQueue.front().value;
+    }
+
+    template <typename Set>
+    double RollingPointSource<Set>::maxX() const {
+        return maxXQueue.empty() ? 0 : maxXQueue.front().value;
+    }
+
+    template <typename Set>
+    double RollingPointSource<Set>::minY() const {
+        return minYQueue.empty() ? 0 : minYQueue.front().value;
+    }
+
+    template <typename Set>
+    double RollingPointSource<Set>::maxY() const {
+        return maxYQueue.empty() ? 0 : maxYQueue.front().value;
+    }
+
+    template class RollingPointSource<DataSet>;
+
+    void DataSet::addPoint(double x, double y){
+        if (!ownsPoints){
+            return;
+        }
+        // once full, the new point overwrites the oldest one and the
+        // head moves forward, so appending never moves existing points
+        int pos = bufferIndex(currentSize);
+        if (sumY != NULL){
+            updateStats(pos, y);
+        }
+        if (history != NULL && currentSize == maxSize){
+            history->append(points[pos]);
+        }
+        points[pos] = ChartPoint(x, y);
         if (currentSize < maxSize){
-            points[currentSize] = ChartPoint(totalPoints, y);
             currentSize++;
-            totalPoints++;
         }
         else {
-            for (int i = 1; i < maxSize; i++){
-                points[i-1] = points[i];
+            head = (head + 1 == maxSize) ? 0 : head + 1;
+            if (sumY != NULL && head == 0){
+                // rebase the sums on the point before the oldest, once
+                // per trip around the buffer
+                double baseY = sumY[0] - points[0].y;
+                double baseY2 = sumY2[0] - points[0].y * points[0].y;
+                for (int i = 0; i < maxSize; i++){
+                    sumY[i] -= baseY;
+                    sumY2[i] -= baseY2;
+                }
             }
-            points[currentSize - 1] = ChartPoint(totalPoints, y);
-            totalPoints++;
         }
+        int seq = totalPoints;
+        int oldestSeq = seq - currentSize + 1;
+        if (!lodLevels.empty()){
+            updateLod(seq, y);
+        }
+        pushExtremaX(oldestSeq, seq, x);
+        pushExtremaY(oldestSeq, seq, y);
+        totalPoints++;
+        revision++;
+    }
+
+    void DataSet::clear(){
+        if (!ownsPoints){
+            return;
+        }
+        currentSize = 0;
+        head = 0;
+        revision++;
+        emaValue = 0;
+        positiveBuckets.clear();
+        negativeBuckets.clear();
+        zeroCount = 0;
+        clearExtrema();
+        if (history != NULL){
+            history->clear();
+        }
+    }
+
+    void DataSet::addPoint2(double y){
+        addPoint(totalPoints, y);
+    }
+
+    const ChartPoint* DataSet::readPoints(int first, int count, ChartPoint* scratch) const {
+        int start = bufferIndex(first);
+        if (start + count <= maxSize){
+            return points + start;
+        }
+        int firstPart = maxSize - start;
+        std::copy(points + start, points + maxSize, scratch);
+        std::copy(points, points + count - firstPart, scratch + firstPart);
+        return scratch;
+    }
+
+    DataSpan DataSet::firstSpan() const {
+        int firstSize = std::min(currentSize, maxSize - head);
+        return DataSpan({points + head, firstSize});
+    }
+
+    DataSpan DataSet::secondSpan() const {
+        int firstSize = std::min(currentSize, maxSize - head);
+        return DataSpan({points, currentSize - firstSize});
     }
 
     double DataSet::averageLastPoints(int numPoints) const {
+        if (sumY != NULL){
+            int count = std::min(numPoints, currentSize);
+            return (count > 0) ? sumLastPoints(count, false) / count : 0;
+        }
         double sum = 0;
         int pointCount = 0;
         for (int i = currentSize - 1; i > currentSize - numPoints - 1; i--){
             if (i < 0){
                 break;
             }
-            sum += points[i].y;
+            sum += getPoint(i).y;
             pointCount++;
         }
         if (pointCount == 0){
@@ -70,9 +337,500 @@ namespace ChartTools {
 
     }
 
+    void DataSet::enableRollingStats(double alpha, int window, double accuracy){
+        if (sumY == NULL){
+            sumY = new double[maxSize];
+            sumY2 = new double[maxSize];
+            double runningY = 0;
+            double runningY2 = 0;
+            for (int i = 0; i < currentSize; i++){
+                double y = getPoint(i).y;
+                runningY += y;
+                runningY2 += y * y;
+                sumY[bufferIndex(i)] = runningY;
+                sumY2[bufferIndex(i)] = runningY2;
+            }
+        }
+        emaAlpha = alpha;
+        emaValue = (currentSize > 0) ? getPoint(currentSize - 1).y : 0;
+        quantileWindow = (window > 0) ? std::min(window, maxSize) : maxSize;
+        quantileGamma = (1 + accuracy) / (1 - accuracy);
+        positiveBuckets.clear();
+        negativeBuckets.clear();
+        zeroCount = 0;
+        for (int i = std::max(0, currentSize - quantileWindow); i < currentSize; i++){
+            updateSketch(getPoint(i).y, 1);
+        }
+    }
+
+    void DataSet::updateStats(int pos, double y){
+        double prevY = 0;
+        double prevY2 = 0;
+        if (currentSize > 0){
+            prevY = sumY[bufferIndex(currentSize - 1)];
+            prevY2 = sumY2[bufferIndex(currentSize - 1)];
+        }
+        sumY[pos] = prevY + y;
+        sumY2[pos] = prevY2 + y * y;
+
+        emaValue = (currentSize > 0) ? emaValue + emaAlpha * (y - emaValue) : y;
+
+        // the point leaving the quantile window is still buffered, as the
+        // new one hasn't been written yet
+        if (currentSize >= quantileWindow){
+            updateSketch(getPoint(currentSize - quantileWindow).y, -1);
+        }
+        updateSketch(y, 1);
+    }
+
+    double DataSet::sumLastPoints(int numPoints, bool squares) const {
+        // the cumulative sums run through each point, so the sum from the
+        // first point on adds that point back
+        const double* sums = squares ? sumY2 : sumY;
+        int first = currentSize - numPoints;
+        double firstY = getPoint(first).y;
+        return sums[bufferIndex(currentSize - 1)] - sums[bufferIndex(first)]
+               + (squares ? firstY * firstY : firstY);
+    }
+
+    double DataSet::varianceLastPoints(int numPoints) const {
+        int count = std::min(numPoints, currentSize);
+        if (sumY == NULL || count <= 0){
+            return 0;
+        }
+        double mean = sumLastPoints(count, false) / count;
+        double meanSquare = sumLastPoints(count, true) / count;
+        return std::fmax(meanSquare - mean * mean, 0);
+    }
+
+    int DataSet::quantileBucket(double magnitude) const {
+        return (int)std::ceil(std::log(magnitude) / std::log(quantileGamma));
+    }
+
+    void DataSet::updateSketch(double y, int delta){
+        if (y > 0){
+            int& count = positiveBuckets[quantileBucket(y)];
+            count += delta;
+            if (count == 0){
+                positiveBuckets.erase(quantileBucket(y));
+            }
+        }
+        else if (y < 0){
+            int& count = negativeBuckets[quantileBucket(-y)];
+            count += delta;
+            if (count == 0){
+                negativeBuckets.erase(quantileBucket(-y));
+            }
+        }
+        else {
+            zeroCount += delta;
+        }
+    }
+
+    double DataSet::quantile(double q) const {
+        int count = std::min(quantileWindow, currentSize);
+        if (sumY == NULL || count == 0){
+            return 0;
+        }
+        // walk the buckets in value order to the one holding the q-th value,
+        // and answer with the middle of that bucket
+        int rank = (int)(std::clamp(q, 0.0, 1.0) * (count - 1));
+        int seen = 0;
+        for (auto it = negativeBuckets.rbegin(); it != negativeBuckets.rend(); it++){
+            seen += it->second;
+            if (seen > rank){
+                return -2 * std::pow(quantileGamma, it->first) / (quantileGamma + 1);
+            }
+        }
+        seen += zeroCount;
+        if (seen > rank){
+            return 0;
+        }
+        for (auto it = positiveBuckets.begin(); it != positiveBuckets.end(); it++){
+            seen += it->second;
+            if (seen > rank){
+                return 2 * std::pow(quantileGamma, it->first) / (quantileGamma + 1);
+            }
+        }
+        return 0;
+    }
+
+
+    void DataSet::enableLevelOfDetail(){
+        if (!lodLevels.empty()){
+            return;
+        }
+        // (runs stop at 2^30 points, which keeps every shift within an int)
+        for (int runLength = 8; ; runLength *= 8){
+            lodLevels.push_back(std::vector<LodBucket>(maxSize / runLength + 2,
+                                                       LodBucket({-1, 0, 0, 0, 0})));
+            if (runLength >= maxSize || runLength >= (1 << 30)){
+                break;
+            }
+        }
+        int firstSeq = totalPoints - currentSize;
+        for (int i = 0; i < currentSize; i++){
+            updateLod(firstSeq + i, getPoint(i).y);
+        }
+    }
+
+    void DataSet::updateLod(int seq, double y){
+        int shift = 3;
+        for (std::vector<LodBucket>& level : lodLevels){
+            int index = seq >> shift;
+            LodBucket& bucket = level[index % level.size()];
+            if (bucket.index != index){
+                bucket = LodBucket({index, seq, seq, y, y});
+            }
+            else {
+                if (y < bucket.minY){
+                    bucket.minY = y;
+                    bucket.minSeq = seq;
+                }
+                if (y > bucket.maxY){
+                    bucket.maxY = y;
+                    bucket.maxSeq = seq;
+                }
+            }
+            shift += 3;
+        }
+    }
+
+    void DataSet::rangeExtrema(int first, int last, int* minIndex, int* maxIndex) const {
+        int firstSeq = totalPoints - currentSize;
+        int lo = firstSeq + first;
+        int hi = firstSeq + last;
+        int minSeq = lo;
+        int maxSeq = lo;
+        double minY = getPoint(first).y;
+        double maxY = minY;
+        // step through the range using the largest aligned run that fits
+        // at each position; every level is used at most 14 times
+        for (int seq = lo; seq <= hi; ){
+            int level = -1;
+            while (level + 1 < (int)lodLevels.size()){
+                int runLength = 1 << (3 * (level + 2));
+                if (seq % runLength != 0 || seq + runLength - 1 > hi){
+                    break;
+                }
+                level++;
+            }
+            if (level < 0){
+                double y = getPoint(seq - firstSeq).y;
+                if (y < minY){
+                    minY = y;
+                    minSeq = seq;
+                }
+                if (y > maxY){
+                    maxY = y;
+                    maxSeq = seq;
+                }
+                seq++;
+            }
+            else {
+                const std::vector<LodBucket>& buckets = lodLevels[level];
+                const LodBucket& bucket = buckets[(seq >> (3 * (level + 1))) % buckets.size()];
+                if (bucket.minY < minY){
+                    minY = bucket.minY;
+                    minSeq = bucket.minSeq;
+                }
+                if (bucket.maxY > maxY){
+                    maxY = bucket.maxY;
+                    maxSeq = bucket.maxSeq;
+                }
+                seq += 1 << (3 * (level + 1));
+            }
+        }
+        *minIndex = minSeq - firstSeq;
+        *maxIndex = maxSeq - firstSeq;
+    }
+
+    int DataSet::lowerBoundX(double x) const {
+        int lo = 0;
+        int hi = currentSize;
+        while (lo < hi){
+            int mid = lo + (hi - lo) / 2;
+            if (getPoint(mid).x < x){
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    void DataSet::enableHistory(int maxPoints, int blockSize){
+        if (ownsPoints && history == NULL){
+            history = new CompressedHistory(maxPoints, blockSize);
+        }
+    }
+
+    int DataSet::historySize() const {
+        return (history != NULL) ? history->size() : 0;
+    }
+
+    size_t DataSet::historyBytes() const {
+        return (history != NULL) ? history->bytes() : 0;
+    }
+
+    void DataSet::readHistory(double xFrom, double xTo, std::vector<ChartPoint>& out) const {
+        if (history != NULL){
+            history->read(xFrom, xTo, out);
+        }
+    }
+
+    // rounds to the nearest sample, saturating at the limits of T; NaN has
+    // no integer sample and is stored as 0. Only values known to be in range
+    // are converted, since converting any other is undefined.
+    template <typename T>
+    static T toSample(double value){
+        if constexpr (std::is_integral<T>::value){
+            if (std::isnan(value)){
+                return 0;
+            }
+            double rounded = std::round(value);
+            if (rounded <= (double)std::numeric_limits<T>::min()){
+                return std::numeric_limits<T>::min();
+            }
+            if (rounded >= (double)std::numeric_limits<T>::max()){
+                return std::numeric_limits<T>::max();
+            }
+            return (T)rounded;
+        }
+        else {
+            // NaN and infinities convert as they are
+            if (std::isfinite(value) && std::fabs(value) > std::numeric_limits<T>::max()){
+                return std::copysign(std::numeric_limits<T>::infinity(), value);
+            }
+            return (T)value;
+        }
+    }
+
+    template <typename T>
+    CompactDataSet<T>::CompactDataSet(int setSize, bool implicitX) :
+        maxSize (setSize), currentSize (0), totalPoints (0), head (0), xs (NULL), revision (0) {
+        ys = new T[maxSize];
+        if (!implicitX){
+            xs = new double[maxSize];
+        }
+    }
+
+    template <typename T>
+    CompactDataSet<T>::~CompactDataSet(){
+        delete[] ys;
+        delete[] xs;
+    }
+
+    template <typename T>
+    void CompactDataSet<T>::addPoint(double x, double y){
+        int pos = bufferIndex(currentSize);
+        T sample = toSample<T>(y);
+        ys[pos] = sample;
+        if (xs != NULL){
+            xs[pos] = x;
+        }
+        if (currentSize < maxSize){
+            currentSize++;
+        }
+        else {
+            head = (head + 1 == maxSize) ? 0 : head + 1;
+        }
+        int seq = totalPoints;
+        int oldestSeq = seq - currentSize + 1;
+        if (xs != NULL){
+            this->pushExtremaX(oldestSeq, seq, x);
+        }
+        // the extrema are of the stored values
+        this->pushExtremaY(oldestSeq, seq, sample);
+        totalPoints++;
+        revision++;
+    }
+
+    template <typename T>
+    void CompactDataSet<T>::addPoint2(double y){
+        addPoint(totalPoints, y);
+    }
+
+    template <typename T>
+    void CompactDataSet<T>::clear(){
+        currentSize = 0;
+        head = 0;
+        revision++;
+        this->clearExtrema();
+    }
+
+    template <typename T>
+    const ChartPoint* CompactDataSet<T>::readPoints(int first, int count, ChartPoint* scratch) const {
+        // walk each contiguous part of the ring, so the inner loop is a
+        // plain conversion the compiler can vectorize
+        int done = 0;
+        while (done < count){
+            int start = bufferIndex(first + done);
+            int run = std::min(count - done, maxSize - start);
+            ChartPoint* out = scratch + done;
+            if (xs != NULL){
+                for (int i = 0; i < run; i++){
+                    out[i].x = xs[start + i];
+                    out[i].y = ys[start + i];
+                }
+            }
+            else {
+                double x = totalPoints - currentSize + first + done;
+                for (int i = 0; i < run; i++){
+                    out[i].x = x + i;
+                    out[i].y = ys[start + i];
+                }
+            }
+            done += run;
+        }
+        return scratch;
+    }
+
+    template <typename T>
+    double CompactDataSet<T>::minX() const {
+        if (xs == NULL){
+            return currentSize > 0 ? xAt(0) : 0;
+        }
+        return RollingPointSource<CompactDataSet<T>>::minX();
+    }
+
+    template <typename T>
+    double CompactDataSet<T>::maxX() const {
+        if (xs == NULL){
+            return currentSize > 0 ? xAt(currentSize - 1) : 0;
+        }
+        return RollingPointSource<CompactDataSet<T>>::maxX();
+    }
+
+    template <typename T>
+    void CompactDataSet<T>::rangeExtrema(int first, int last, int* minIndex, int* maxIndex) const {
+        *minIndex = first;
+        *maxIndex = first;
+        T minY = ys[bufferIndex(first)];
+        T maxY = minY;
+        for (int i = first + 1; i <= last; i++){
+            T y = ys[bufferIndex(i)];
+            if (y < minY){
+                minY = y;
+                *minIndex = i;
+            }
+            if (y > maxY){
+                maxY = y;
+                *maxIndex = i;
+            }
+        }
+    }
+
+    template <typename T>
+    int CompactDataSet<T>::lowerBoundX(double x) const {
+        if (xs == NULL){
+            // implicit x counts up by one from the oldest point
+            double offset = std::ceil(x - (totalPoints - currentSize));
+            return (int)std::clamp(offset, 0.0, (double)currentSize);
+        }
+        int lo = 0;
+        int hi = currentSize;
+        while (lo < hi){
+            int mid = lo + (hi - lo) / 2;
+            if (xs[bufferIndex(mid)] < x){
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    template class RollingPointSource<CompactDataSet<float>>;
+    template class RollingPointSource<CompactDataSet<int16_t>>;
+    template class RollingPointSource<CompactDataSet<int32_t>>;
+    template class RollingPointSource<CompactDataSet<double>>;
+    template class CompactDataSet<float>;
+    template class CompactDataSet<int16_t>;
+    template class CompactDataSet<int32_t>;
+    template class CompactDataSet<double>;
 
-    LineChart::LineChart(GraphicsTools::Window* parent, DataSet* dataset, int drawX, int drawY, int width, int height) :
-        parentWindow (parent), data (dataset), drawPosX (drawX), drawPosY (drawY), drawWidth (width), drawHeight (height), scaleModesX (NONE), scaleModesY (NONE){
+    int saveSeries(const DataSet& set, std::string filename){
+        SeriesFileHeader header = {};
+        memcpy(header.magic, "MBSERIES", sizeof(header.magic));
+        header.version = 1;
+        header.pointSize = sizeof(ChartPoint);
+        header.count = set.getCurrentSize();
+        header.minX = set.minX();
+        header.maxX = set.maxX();
+        header.minY = set.minY();
+        header.maxY = set.maxY();
+
+        FILE* out = fopen(filename.c_str(), "wb");
+        if (out == NULL){
+            std::cerr << "cannot open " << filename << "\n";
+            return -1;
+        }
+        DataSpan spans[2] = {set.firstSpan(), set.secondSpan()};
+        bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+        for (const DataSpan& span : spans){
+            if (ok && span.size > 0){
+                ok = fwrite(span.points, sizeof(ChartPoint), span.size, out) == (size_t)span.size;
+            }
+        }
+        if (fclose(out) != 0 || !ok){
+            std::cerr << "cannot write " << filename << "\n";
+            return -1;
+        }
+        return 0;
+    }
+
+    MappedSeries::MappedSeries(std::string filename) :
+        mapping (NULL), mappingSize (0), view (NULL) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0){
+            std::cerr << "cannot open " << filename << "\n";
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(SeriesFileHeader)){
+            std::cerr << filename << " is not a series file\n";
+            close(fd);
+            return;
+        }
+        void* m = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (m == MAP_FAILED){
+            std::cerr << "cannot map " << filename << "\n";
+            return;
+        }
+        mapping = m;
+        mappingSize = info.st_size;
+
+        const SeriesFileHeader* header = (const SeriesFileHeader*)mapping;
+        size_t room = (mappingSize - sizeof(SeriesFileHeader)) / sizeof(ChartPoint);
+        if (memcmp(header->magic, "MBSERIES", sizeof(header->magic)) != 0 || header->version != 1
+            || header->pointSize != sizeof(ChartPoint) || header->count > (uint64_t)INT_MAX
+            || header->count > room){
+            std::cerr << filename << " is not a series file\n";
+            return;
+        }
+        // the header keeps the points after it aligned within the page
+        const ChartPoint* first = (const ChartPoint*)((const char*)mapping + sizeof(SeriesFileHeader));
+        view = new DataSet(first, (int)header->count, ChartPoint(header->minX, header->minY),
+                           ChartPoint(header->maxX, header->maxY));
+    }
+
+    MappedSeries::~MappedSeries(){
+        delete view;
+        if (mapping != NULL){
+            munmap(mapping, mappingSize);
+        }
+    }
+
+
+    LineChart::LineChart(GraphicsTools::Window* parent, PointSource* dataset, int drawX, int drawY, int width, int height) :
+        parentWindow (parent), data (dataset), drawPosX (drawX), drawPosY (drawY), drawWidth (width), drawHeight (height), readScratch (1024), decimation (NO_DECIMATION),
+        gridLayer (NULL), frameLayer (NULL), layerX (0), layerY (0), layerW (0), layerH (0), layersDirty (true), layersFailed (false), scaleModesX (NONE), scaleModesY (NONE),
+        scrolling (false), scrollLayer (NULL), scrollValid (false), scrollXScale (0), scrollXOrigin (0),
+        scrollYScale (0), scrollYOffset (0), scrollFront (0), drawnRevision (0), viewDirty (true){
 
         borderColor = GraphicsTools::Colors::White;
         gridColor = GraphicsTools::ColorRgba({255, 200, 200, 63});
@@ -80,6 +838,7 @@ namespace ChartTools {
         dataColor = GraphicsTools::Colors::Green;
 
         showLabels = false;
+        labelFont = NULL;
 
         xAxisMin = 0;
         xAxisMax = 60;
@@ -93,46 +852,71 @@ namespace ChartTools {
         ySoftMarginBottom = 0.05;
         ySoftMarginTop = 0.15;
 
+        updateTransform();
+
         yAxisSmMin = mapY((yAxisMin * ySoftMarginBottom) + (yAxisMax * (1 - ySoftMarginTop)));
         yAxisSmMax = mapY((yAxisMin * (1 - ySoftMarginBottom)) + (yAxisMax *ySoftMarginTop));
 
     }
 
-    LineChart::~LineChart(){}
+    LineChart::~LineChart(){
+        parentWindow->destroyLayer(gridLayer);
+        parentWindow->destroyLayer(frameLayer);
+        parentWindow->destroyLayer(scrollLayer);
+    }
+
+    void LineChart::updateTransform(){
+        xScale = drawWidth / (xAxisMax - xAxisMin);
+        xOffset = drawPosX - xAxisMin * xScale;
+        yScale = -drawHeight / (yAxisMax - yAxisMin);
+        yOffset = drawPosY + drawHeight - yAxisMin * yScale;
+    }
 
     int LineChart::mapX(double sourceVal){
-        double sourceMin = xAxisMin;
-        double sourceMax = xAxisMax;
-        double targetMin = drawPosX;
-        double targetMax = drawPosX + drawWidth;
-        return targetMin+(((targetMax - targetMin)*(sourceVal-sourceMin))/(sourceMax - sourceMin));
+        return sourceVal * xScale + xOffset;
     }
 
     int LineChart::mapY(double sourceVal){
-        double sourceMin = yAxisMin;
-        double sourceMax = yAxisMax;
-        double targetMin = drawPosY + drawHeight;
-        double targetMax = drawPosY;
-        return targetMin+(((targetMax - targetMin)*(sourceVal-sourceMin))/(sourceMax - sourceMin));
+        return sourceVal * yScale + yOffset;
     }
 
-    void LineChart::autoScaleX(){
-        double maxPointVal = data->getPoint(0).x;
-        double minPointVal = data->getPoint(0).x;
-        for (int i = 1; i < data->getCurrentSize(); i++){
-            if (data->getPoint(i).x > maxPointVal){
-                maxPointVal = data->getPoint(i).x;
-            }
-            if (data->getPoint(i).x < minPointVal){
-                minPointVal = data->getPoint(i).x;
-            }
+    void LineChart::mapPoints(const ChartPoint* source, int count, SDL_FPoint* target) const {
+        // a ChartPoint is an (x, y) pair of doubles and an SDL_FPoint an
+        // (x, y) pair of floats, so both coordinates map in the same lanes
+        int i = 0;
+#if defined(__AVX__)
+        __m256d scale = _mm256_setr_pd(xScale, yScale, xScale, yScale);
+        __m256d offset = _mm256_setr_pd(xOffset, yOffset, xOffset, yOffset);
+        for (; i + 2 <= count; i += 2){
+            __m256d p = _mm256_loadu_pd(&source[i].x);
+            p = _mm256_add_pd(_mm256_mul_pd(p, scale), offset);
+            _mm_storeu_ps(&target[i].x, _mm256_cvtpd_ps(p));
+        }
+#elif defined(__SSE2__)
+        // two points a step, their float halves joined into one store
+        __m128d scale = _mm_setr_pd(xScale, yScale);
+        __m128d offset = _mm_setr_pd(xOffset, yOffset);
+        for (; i + 2 <= count; i += 2){
+            __m128d p0 = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(&source[i].x), scale), offset);
+            __m128d p1 = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(&source[i + 1].x), scale), offset);
+            _mm_storeu_ps(&target[i].x, _mm_movelh_ps(_mm_cvtpd_ps(p0), _mm_cvtpd_ps(p1)));
         }
+#endif
+        for (; i < count; i++){
+            target[i].x = source[i].x * xScale + xOffset;
+            target[i].y = source[i].y * yScale + yOffset;
+        }
+    }
+
+    void LineChart::autoScaleX(){
+        double maxPointVal = data->maxX();
+        double minPointVal = data->minX();
         double newXMin = xAxisMin;
         double newXMax = xAxisMax;
-        if (scaleModesX | SCALE_MIN){
+        if (scaleModesX & SCALE_MIN){
             newXMin = minPointVal;
         }
-        if (scaleModesX | SCALE_MAX){
+        if (scaleModesX & SCALE_MAX){
             newXMax = maxPointVal;
         }
         setAxes(newXMin, newXMax, yAxisMin, yAxisMax);
@@ -140,22 +924,14 @@ namespace ChartTools {
     }
 
     void LineChart::autoScaleY(){
-        double maxPointVal = data->getPoint(0).y;
-        double minPointVal = data->getPoint(0).y;
-        for (int i = 1; i < data->getCurrentSize(); i++){
-            if (data->getPoint(i).y > maxPointVal){
-                maxPointVal = data->getPoint(i).y;
-            }
-            if (data->getPoint(i).y < minPointVal){
-                minPointVal = data->getPoint(i).y;
-            }
-        }
+        double maxPointVal = data->maxY();
+        double minPointVal = data->minY();
         double newYMin = yAxisMin;
         double newYMax = yAxisMax;
-        if (scaleModesY | SCALE_MIN){
+        if (scaleModesY & SCALE_MIN){
             newYMin = yAxisSmMin - ((yAxisMax-yAxisMin)*ySoftMarginBottom);
         }
-        if (scaleModesY | SCALE_MAX){
+        if (scaleModesY & SCALE_MAX){
             newYMax = yAxisSmMax + ((yAxisMax-yAxisMin)*ySoftMarginTop);
         }
         yAxisSmMax = std::fmax(maxPointVal, 0);
@@ -164,12 +940,208 @@ namespace ChartTools {
 
     }
 
-    void LineChart::draw(){
+    template <typename Visit>
+    void LineChart::forEachBlock(int first, int end, Visit visit){
+        for (int start = first; start < end; start += readScratch.size()){
+            int count = std::min((int)readScratch.size(), end - start);
+            visit(data->readPoints(start, count, readScratch.data()), count, start);
+        }
+    }
 
-        // Scaling
-        autoScaleX();
-        autoScaleY();
+    // M4 in one pass: points are added in order and each column of the
+    // chart keeps its first, lowest, highest and last point; points left or
+    // right of the chart share one column per side
+    class M4Columns {
+    public:
+        M4Columns(std::vector<ChartPoint>& target, double xMin, double colScale, int width) :
+            out (target), xAxisMin (xMin), scale (colScale), drawWidth (width), col (0), index (0),
+            firstIdx (0), minIdx (0), maxIdx (0), lastIdx (0) {}
+
+        void add(const ChartPoint* points, int count){
+            for (int i = 0; i < count; i++, index++){
+                const ChartPoint& p = points[i];
+                int c = std::clamp(std::floor((p.x - xAxisMin) * scale),
+                                   -1.0, (double)drawWidth);
+                if (index == 0 || c != col){
+                    if (index > 0){
+                        flushColumn();
+                    }
+                    col = c;
+                    firstIdx = minIdx = maxIdx = index;
+                    firstP = minP = maxP = p;
+                }
+                else {
+                    if (p.y < minP.y){
+                        minIdx = index;
+                        minP = p;
+                    }
+                    if (p.y > maxP.y){
+                        maxIdx = index;
+                        maxP = p;
+                    }
+                }
+                lastIdx = index;
+                lastP = p;
+            }
+        }
+
+        void finish(){
+            if (index > 0){
+                flushColumn();
+            }
+        }
 
+    private:
+        std::vector<ChartPoint>& out;
+        double xAxisMin;
+        double scale;
+        int drawWidth;
+        int col;
+        int index;
+        int firstIdx, minIdx, maxIdx, lastIdx;
+        ChartPoint firstP, minP, maxP, lastP;
+
+        void flushColumn(){
+            bool minFirst = minIdx <= maxIdx;
+            int lo = minFirst ? minIdx : maxIdx;
+            int hi = minFirst ? maxIdx : minIdx;
+            out.push_back(firstP);
+            if (lo != firstIdx && lo != lastIdx){
+                out.push_back(minFirst ? minP : maxP);
+            }
+            if (hi != lo && hi != firstIdx && hi != lastIdx){
+                out.push_back(minFirst ? maxP : minP);
+            }
+            if (lastIdx != firstIdx){
+                out.push_back(lastP);
+            }
+        }
+    };
+
+    void LineChart::decimateM4(){
+        decimatedPoints.clear();
+        M4Columns columns(decimatedPoints, xAxisMin, drawWidth / (xAxisMax - xAxisMin), drawWidth);
+        forEachBlock(0, data->getCurrentSize(), [&](const ChartPoint* block, int count, int){
+            columns.add(block, count);
+        });
+        columns.finish();
+    }
+
+    void LineChart::drawHistory(){
+        historyPoints.clear();
+        data->readHistory(xAxisMin, xAxisMax, historyPoints);
+        if (historyPoints.empty()){
+            return;
+        }
+        // joined to the oldest buffered point, so the line doesn't break
+        // where the history ends
+        if (data->getCurrentSize() > 0){
+            historyPoints.push_back(data->getPoint(0));
+        }
+        if (decimation != NO_DECIMATION && historyPoints.size() > 4 * (size_t)drawWidth){
+            decimatedPoints.clear();
+            M4Columns columns(decimatedPoints, xAxisMin, drawWidth / (xAxisMax - xAxisMin), drawWidth);
+            columns.add(historyPoints.data(), historyPoints.size());
+            columns.finish();
+            historyPoints.swap(decimatedPoints);
+        }
+        screenPoints.resize(historyPoints.size());
+        mapPoints(historyPoints.data(), historyPoints.size(), screenPoints.data());
+        parentWindow->drawPolyline(dataColor, 4, screenPoints.data(), screenPoints.size());
+    }
+
+    void LineChart::decimateM4Lod(){
+        decimatedPoints.clear();
+        // like decimateM4, but each column's points are found by binary
+        // search and summarized from the level-of-detail index, so the cost
+        // follows the chart width rather than the number of points
+        int n = data->getCurrentSize();
+        int start = data->lowerBoundX(xAxisMin);
+        if (start > 0){
+            decimatedPoints.push_back(data->getPoint(start - 1));
+        }
+        double colWidth = (xAxisMax - xAxisMin) / drawWidth;
+        // the last column ends at the axis maximum, as in decimateM4
+        for (int col = 0; col < drawWidth && start < n; col++){
+            double colEnd = (col == drawWidth - 1) ? xAxisMax : xAxisMin + (col + 1) * colWidth;
+            int end = data->lowerBoundX(colEnd);
+            if (end > start){
+                int minIdx, maxIdx;
+                data->rangeExtrema(start, end - 1, &minIdx, &maxIdx);
+                int lo = std::min(minIdx, maxIdx);
+                int hi = std::max(minIdx, maxIdx);
+                decimatedPoints.push_back(data->getPoint(start));
+                if (lo != start && lo != end - 1){
+                    decimatedPoints.push_back(data->getPoint(lo));
+                }
+                if (hi != lo && hi != start && hi != end - 1){
+                    decimatedPoints.push_back(data->getPoint(hi));
+                }
+                if (end - 1 != start){
+                    decimatedPoints.push_back(data->getPoint(end - 1));
+                }
+            }
+            start = end;
+        }
+        if (start < n){
+            decimatedPoints.push_back(data->getPoint(start));
+        }
+    }
+
+    void LineChart::decimateLttb(int threshold){
+        decimatedPoints.clear();
+        int n = data->getCurrentSize();
+        if (threshold < 3 || n <= threshold){
+            forEachBlock(0, n, [&](const ChartPoint* block, int count, int){
+                decimatedPoints.insert(decimatedPoints.end(), block, block + count);
+            });
+            return;
+        }
+
+        // the first and last points are kept; the rest are split into
+        // buckets, each contributing the point that forms the largest
+        // triangle with the previous pick and the next bucket's average
+        double every = (double)(n - 2) / (threshold - 2);
+        int a = 0;
+        decimatedPoints.push_back(data->getPoint(0));
+        for (int b = 0; b < threshold - 2; b++){
+            int avgStart = (int)((b + 1) * every) + 1;
+            int avgEnd = std::min((int)((b + 2) * every) + 1, n);
+            double avgX = 0;
+            double avgY = 0;
+            forEachBlock(avgStart, avgEnd, [&](const ChartPoint* block, int count, int){
+                for (int i = 0; i < count; i++){
+                    avgX += block[i].x;
+                    avgY += block[i].y;
+                }
+            });
+            int avgCount = std::max(avgEnd - avgStart, 1);
+            avgX /= avgCount;
+            avgY /= avgCount;
+
+            ChartPoint pa = data->getPoint(a);
+            int bucketStart = (int)(b * every) + 1;
+            int bucketEnd = (int)((b + 1) * every) + 1;
+            double maxArea = -1;
+            int maxIdx = bucketStart;
+            forEachBlock(bucketStart, bucketEnd, [&](const ChartPoint* block, int count, int start){
+                for (int i = 0; i < count; i++){
+                    const ChartPoint& p = block[i];
+                    double area = std::fabs((pa.x - avgX) * (p.y - pa.y)
+                                            - (pa.x - p.x) * (avgY - pa.y));
+                    if (area > maxArea){
+                        maxArea = area;
+                        maxIdx = start + i;
+                    }
+                }
+            });
+            decimatedPoints.push_back(data->getPoint(maxIdx));
+            a = maxIdx;
+        }
+        decimatedPoints.push_back(data->getPoint(n - 1));
+    }
+
+    void LineChart::drawGrid(){
         // Y-grid (vertical lines)
         for (int _x = xAxisMin + std::fmod(-xAxisMin, xGridInterval); _x <= xAxisMax; _x += xGridInterval){
             if (_x > xAxisMin && _x < xAxisMax){
@@ -180,60 +1152,489 @@ namespace ChartTools {
         // X-grid (horizontal lines)
         for (int _y = yAxisMin + std::fmod(-yAxisMin, yGridInterval); _y <= yAxisMax; _y += yGridInterval){
             if (_y > yAxisMin && _y < yAxisMax){
-                parentWindow->drawText(std::to_string(_y), labelFont, GraphicsTools::Colors::White, drawPosX - 20, mapY(_y) - 10, GraphicsTools::TextAlignModeH::Right);
+                if (showLabels && labelFont != NULL){
+                    parentWindow->drawText(std::to_string(_y), labelFont, GraphicsTools::Colors::White, drawPosX - 20, mapY(_y) - 10, GraphicsTools::TextAlignModeH::Right);
+                }
                 parentWindow->drawLine(gridColor, 1,
                     drawPosX, mapY(_y), drawPosX+drawWidth, mapY(_y));
             }
         }
+    }
+
+    void LineChart::drawFrame(){
+        // X-axis (y = 0)
+        int xAxisPosition = mapY(0);
+        if (xAxisPosition > drawPosY && xAxisPosition < drawPosY + drawHeight){
+            parentWindow->drawLine(GraphicsTools::Colors::Grey, 4, drawPosX, mapY(0), drawPosX + drawWidth, mapY(0));
+        }
+        // X-axis, Y-axis and their parallels as one closed outline
+        SDL_FPoint border[5] = {
+            {(float)drawPosX, (float)drawPosY},
+            {(float)(drawPosX + drawWidth), (float)drawPosY},
+            {(float)(drawPosX + drawWidth), (float)(drawPosY + drawHeight)},
+            {(float)drawPosX, (float)(drawPosY + drawHeight)},
+            {(float)drawPosX, (float)drawPosY}
+        };
+        parentWindow->drawPolyline(borderColor, 4, border, 5);
+    }
+
+    void LineChart::renderLayers(){
+        layersDirty = false;
+        if (layersFailed){
+            return;
+        }
+
+        // the layers cover the chart and its 4px border, plus the labels
+        int left = drawPosX - 3;
+        int top = drawPosY - 3;
+        int right = drawPosX + drawWidth + 3;
+        int bottom = drawPosY + drawHeight + 3;
+        if (showLabels && labelFont != NULL){
+            for (int _y = yAxisMin + std::fmod(-yAxisMin, yGridInterval); _y <= yAxisMax; _y += yGridInterval){
+                if (_y > yAxisMin && _y < yAxisMax){
+                    int w = 0;
+                    int h = 0;
+                    parentWindow->textSize(std::to_string(_y), labelFont, &w, &h);
+                    left = std::min(left, drawPosX - 20 - w);
+                    top = std::min(top, mapY(_y) - 10);
+                    bottom = std::max(bottom, mapY(_y) - 10 + h);
+                }
+            }
+        }
+
+        if (gridLayer == NULL || right - left != layerW || bottom - top != layerH){
+            parentWindow->destroyLayer(gridLayer);
+            parentWindow->destroyLayer(frameLayer);
+            layerW = right - left;
+            layerH = bottom - top;
+            gridLayer = parentWindow->createLayer(layerW, layerH);
+            frameLayer = parentWindow->createLayer(layerW, layerH);
+            if (gridLayer == NULL || frameLayer == NULL){
+                parentWindow->destroyLayer(gridLayer);
+                parentWindow->destroyLayer(frameLayer);
+                gridLayer = NULL;
+                frameLayer = NULL;
+                layersFailed = true;
+                return;
+            }
+        }
+        layerX = left;
+        layerY = top;
+
+        parentWindow->beginLayer(gridLayer, layerX, layerY);
+        drawGrid();
+        parentWindow->endLayer();
+        parentWindow->beginLayer(frameLayer, layerX, layerY);
+        drawFrame();
+        parentWindow->endLayer();
+    }
 
+    void LineChart::draw(){
+
+        // Points queued by other threads
+        data->drainQueue();
+        drawnRevision = data->getRevision();
+
+        // Scaling; the axes approach their scaled values over a few frames,
+        // so ask for another frame until they settle within half a pixel
+        double prevXMin = xAxisMin, prevXMax = xAxisMax;
+        double prevYMin = yAxisMin, prevYMax = yAxisMax;
+        autoScaleX();
+        autoScaleY();
+        viewDirty = std::fabs((xAxisMin - prevXMin) * xScale) >= 0.5
+                    || std::fabs((xAxisMax - prevXMax) * xScale) >= 0.5
+                    || std::fabs((yAxisMin - prevYMin) * yScale) >= 0.5
+                    || std::fabs((yAxisMax - prevYMax) * yScale) >= 0.5;
 
-        // Data
+        if (layersDirty){
+            renderLayers();
+        }
+        if (gridLayer != NULL){
+            parentWindow->drawLayer(gridLayer, layerX, layerY);
+        }
+        else {
+            drawGrid();
+        }
+
+        // Data; compressed history only when the x-axis reaches back
+        // before the buffered points
+        bool showHistory = data->historySize() > 0 && xAxisMin < data->minX();
+        if (showHistory){
+            drawHistory();
+        }
+        if (!scrolling || showHistory || !drawScrolling()){
+            scrollValid = false;
+            drawData();
+        }
+
+        if (frameLayer != NULL){
+            parentWindow->drawLayer(frameLayer, layerX, layerY);
+        }
+        else {
+            drawFrame();
+        }
+    }
+
+    void LineChart::drawData(bool decimate){
         if (data->getCurrentSize() == 1){
             parentWindow->drawCircle(dataColor, mapX(data->getPoint(0).x), mapY(data->getPoint(0).y), 8);
         }
         else if (data->getCurrentSize() > 1){
-            for (int i = 0; i < data->getCurrentSize() - 1; i++){
-                parentWindow->drawLine(dataColor, 4, mapX(data->getPoint(i).x),
-                                                   mapY(data->getPoint(i).y),
-                                                   mapX(data->getPoint(i+1).x),
-                                                   mapY(data->getPoint(i+1).y));
+            if (decimate && ((decimation == DECIMATE_M4 && data->getCurrentSize() > 4 * drawWidth)
+                || (decimation == DECIMATE_LTTB && data->getCurrentSize() > 2 * drawWidth))){
+                if (decimation == DECIMATE_M4 && data->hasLevelOfDetail()){
+                    decimateM4Lod();
+                }
+                else if (decimation == DECIMATE_M4){
+                    decimateM4();
+                }
+                else {
+                    decimateLttb(2 * drawWidth);
+                }
+                screenPoints.resize(decimatedPoints.size());
+                mapPoints(decimatedPoints.data(), decimatedPoints.size(), screenPoints.data());
+            }
+            else {
+                screenPoints.resize(data->getCurrentSize());
+                forEachBlock(0, data->getCurrentSize(), [&](const ChartPoint* block, int count, int start){
+                    mapPoints(block, count, screenPoints.data() + start);
+                });
             }
+            parentWindow->drawPolyline(dataColor, 4, screenPoints.data(), screenPoints.size());
         }
+    }
 
-        // X-axis (y = 0)
-        int xAxisPosition = mapY(0);
-        if (xAxisPosition > drawPosY && xAxisPosition < drawPosY + drawHeight){
-            parentWindow->drawLine(GraphicsTools::Colors::Grey, 4, drawPosX, mapY(0), drawPosX + drawWidth, mapY(0));
+    bool LineChart::drawScrolling(){
+        int n = data->getCurrentSize();
+        // a point right of the chart would wrap around the ring into view
+        if (n < 2 || data->maxX() > xAxisMax){
+            return false;
+        }
+        if (scrollLayer == NULL){
+            scrollLayer = parentWindow->createLayer(drawWidth + scrollMargin, drawHeight);
+            if (scrollLayer == NULL){
+                scrolling = false;
+                return false;
+            }
+        }
+
+        // the ring stays valid while the axes map within half a pixel of
+        // where it puts them and the data only grew at the right
+        double left = xAxisMin * scrollXScale - scrollXOrigin;
+        double front = left + drawWidth;
+        int first = -1;
+        if (scrollValid
+            && std::fabs(xAxisMax * scrollXScale - scrollXOrigin - front) < 0.5
+            && std::fabs(yAxisMin * scrollYScale + scrollYOffset - drawHeight) < 0.5
+            && std::fabs(yAxisMax * scrollYScale + scrollYOffset) < 0.5
+            && front >= scrollFront && front - scrollFront < drawWidth){
+            int last = data->lowerBoundX(scrollLast.x);
+            if (last < n && data->getPoint(last).x == scrollLast.x
+                && data->getPoint(last).y == scrollLast.y){
+                first = last;
+            }
+        }
+
+        if (first < 0){
+            redrawScrollLayer();
+        }
+        else if (first < n - 1 || std::floor(front) != std::floor(scrollFront)){
+            // the columns scrolling into the margin still hold the data of
+            // one trip around the ring ago
+            int width = drawWidth + scrollMargin;
+            long from = (long)std::floor(scrollFront) + scrollMargin;
+            int count = (long)std::floor(front) + scrollMargin - from;
+            int start = ((from % width) + width) % width;
+            int firstPart = std::min(count, width - start);
+            parentWindow->beginLayer(scrollLayer, 0, 0, false);
+            if (count > 0){
+                parentWindow->eraseRectangle(start, 0, firstPart, drawHeight);
+                if (count > firstPart){
+                    parentWindow->eraseRectangle(0, 0, count - firstPart, drawHeight);
+                }
+            }
+            // from the point before the last one drawn, so the joint is
+            // drawn as in a full redraw
+            drawScrollSegments(std::max(first - 1, 0), n);
+            parentWindow->endLayer();
+            scrollFront = front;
+        }
+        scrollLast = data->getPoint(n - 1);
+
+        // the ring from the left edge of the chart, in two parts if it wraps
+        int width = drawWidth + scrollMargin;
+        long leftColumn = std::lround(scrollFront) - drawWidth;
+        int start = ((leftColumn % width) + width) % width;
+        int firstPart = std::min(drawWidth, width - start);
+        parentWindow->drawImageRegion(scrollLayer, SDL_Rect({start, 0, firstPart, drawHeight}),
+                                      SDL_Rect({drawPosX, drawPosY, firstPart, drawHeight}));
+        if (firstPart < drawWidth){
+            parentWindow->drawImageRegion(scrollLayer, SDL_Rect({0, 0, drawWidth - firstPart, drawHeight}),
+                                          SDL_Rect({drawPosX + firstPart, drawPosY, drawWidth - firstPart, drawHeight}));
+        }
+        return true;
+    }
+
+    void LineChart::redrawScrollLayer(){
+        // the ring starts at the left edge of the chart; undecimated, like
+        // the segments drawScrollSegments appends to it
+        parentWindow->beginLayer(scrollLayer, drawPosX, drawPosY);
+        drawData(false);
+        parentWindow->endLayer();
+        scrollXScale = xScale;
+        scrollXOrigin = xAxisMin * xScale;
+        scrollYScale = yScale;
+        scrollYOffset = yOffset - drawPosY;
+        scrollFront = drawWidth;
+        scrollValid = true;
+    }
+
+    void LineChart::drawScrollSegments(int first, int end){
+        // positions in the ring, unwrapped from the ring copy holding the
+        // first point
+        int width = drawWidth + scrollMargin;
+        double base = std::floor((data->getPoint(first).x * scrollXScale - scrollXOrigin) / width) * width;
+        screenPoints.resize(end - first);
+        forEachBlock(first, end, [&](const ChartPoint* block, int count, int start){
+            for (int i = 0; i < count; i++){
+                SDL_FPoint& p = screenPoints[start - first + i];
+                p.x = block[i].x * scrollXScale - scrollXOrigin - base;
+                p.y = block[i].y * scrollYScale + scrollYOffset;
+            }
+        });
+        parentWindow->drawPolyline(dataColor, 4, screenPoints.data(), screenPoints.size());
+
+        // the ends of lines crossing either end of the ring, drawn again at
+        // the other end
+        float minX = screenPoints.front().x, maxX = screenPoints.back().x;
+        for (const SDL_FPoint& p : screenPoints){
+            minX = std::min(minX, p.x);
+            maxX = std::max(maxX, p.x);
+        }
+        for (int wrap : {-width, width}){
+            if ((wrap < 0 && maxX > width - 4) || (wrap > 0 && minX < 4)){
+                for (SDL_FPoint& p : screenPoints){
+                    p.x += wrap;
+                }
+                parentWindow->drawPolyline(dataColor, 4, screenPoints.data(), screenPoints.size());
+                for (SDL_FPoint& p : screenPoints){
+                    p.x -= wrap;
+                }
+            }
         }
-        // X-axis
-        parentWindow->drawLine(borderColor, 4, drawPosX, drawPosY + drawHeight, drawPosX + drawWidth, drawPosY + drawHeight);
-        // X-axis parallel
-        parentWindow->drawLine(borderColor, 4, drawPosX, drawPosY, drawPosX + drawWidth, drawPosY);
-        // Y-axis
-        parentWindow->drawLine(borderColor, 4, drawPosX, drawPosY + drawHeight, drawPosX, drawPosY);
-        // Y-axis parallel
-        parentWindow->drawLine(borderColor, 4, drawPosX + drawWidth, drawPosY + drawHeight, drawPosX + drawWidth, drawPosY);
     }
 
     void LineChart::setAxes(double xMin, double xMax, double yMin, double yMax){
+        if (xMin != xAxisMin || xMax != xAxisMax || yMin != yAxisMin || yMax != yAxisMax){
+            layersDirty = true;
+            viewDirty = true;
+        }
         xAxisMin = xMin;
         xAxisMax = xMax;
         yAxisMin = yMin;
         yAxisMax = yMax;
+        updateTransform();
     }
     void LineChart::setGrid(double xInt, double xOff, double yInt, double yOff){
         xGridInterval = xInt;
         xGridOffset = xOff;
         yGridInterval = yInt;
         yGridOffset = yOff;
+        layersDirty = true;
+        viewDirty = true;
     }
 
     void LineChart::setScaleModes(AutoScaleMode x, AutoScaleMode y){
         scaleModesX = x;
         scaleModesY = y;
+        viewDirty = true;
     }
 
     void LineChart::setLabelFont(GraphicsTools::Font* f){
         labelFont = f;
+        showLabels = (f != NULL);
+        layersDirty = true;
+        viewDirty = true;
+    }
+
+    Dashboard::Dashboard(GraphicsTools::Window* parent) :
+        parentWindow (parent), frameBudget (0), deferredCount (0) {}
+
+    Dashboard::~Dashboard(){
+        for (Panel& panel : panels){
+            parentWindow->destroyLayer(panel.texture);
+            delete panel.chart;
+        }
+    }
+
+    void Dashboard::addChart(LineChart* chart, int x, int y, int w, int h, int priority){
+        SDL_Texture* texture = parentWindow->createLayer(w, h);
+        panels.push_back(Panel({chart, x, y, w, h, priority, 0, texture, false}));
+    }
+
+    void Dashboard::invalidate(){
+        for (Panel& panel : panels){
+            panel.drawn = false;
+        }
+    }
+
+    bool Dashboard::needsRedraw() const {
+        for (const Panel& panel : panels){
+            if (!panel.drawn || panel.chart->needsRedraw()){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Dashboard::draw(){
+        std::vector<Panel*> dirty;
+        for (Panel& panel : panels){
+            if (panel.texture != NULL && (!panel.drawn || panel.chart->needsRedraw())){
+                dirty.push_back(&panel);
+            }
+        }
+        std::stable_sort(dirty.begin(), dirty.end(), [](const Panel* a, const Panel* b){
+            return a->priority + a->waited > b->priority + b->waited;
+        });
+
+        // at least one chart is redrawn each frame, however long it takes
+        Uint64 start = SDL_GetPerformanceCounter();
+        Uint64 budget = frameBudget * SDL_GetPerformanceFrequency();
+        deferredCount = 0;
+        for (Panel* panel : dirty){
+            if (frameBudget > 0 && panel != dirty.front()
+                && SDL_GetPerformanceCounter() - start >= budget){
+                panel->waited++;
+                deferredCount++;
+                continue;
+            }
+            parentWindow->beginLayer(panel->texture, panel->x, panel->y);
+            panel->chart->draw();
+            parentWindow->endLayer();
+            panel->drawn = true;
+            panel->waited = 0;
+        }
+
+        for (Panel& panel : panels){
+            if (panel.texture != NULL){
+                parentWindow->drawLayer(panel.texture, panel.x, panel.y);
+            }
+            else {
+                panel.chart->draw();
+                panel.drawn = true;
+            }
+        }
+    }
+
+    HeatmapChart::HeatmapChart(GraphicsTools::Window* parent, int cols, int rowCount, int drawX, int drawY, int width, int height) :
+        parentWindow (parent), drawPosX (drawX), drawPosY (drawY), drawWidth (width), drawHeight (height),
+        columns (cols), rows (rowCount), nextColumn (0), filledColumns (0), valueMin (0), valueMax (1),
+        columnPixels (rowCount) {
+        texture = parentWindow->createStreamingImage(columns, rows);
+        if (texture != NULL){
+            SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_NONE);
+        }
+        else {
+            cells.resize((size_t)columns * rows);
+        }
+        setHueColorMap(240, 0);
+    }
+
+    HeatmapChart::~HeatmapChart(){
+        parentWindow->destroyLayer(texture);
+    }
+
+    void HeatmapChart::setRange(double min, double max){
+        valueMin = min;
+        valueMax = max;
+    }
+
+    void HeatmapChart::setColorMap(GraphicsTools::ColorRgba low, GraphicsTools::ColorRgba high){
+        for (int i = 0; i < 256; i++){
+            GraphicsTools::ColorRgba8 c = GraphicsTools::blend(low, 255 - i, high, i);
+            c.a = 255;
+            colorMap[i] = c.argb();
+        }
+    }
+
+    void HeatmapChart::setHueColorMap(double lowHue, double highHue, double saturation, double value){
+        GraphicsTools::ColorHsv hues[256];
+        for (int i = 0; i < 256; i++){
+            double hue = lowHue + (highHue - lowHue) * i / 255;
+            hues[i] = GraphicsTools::ColorHsv({std::fmod(std::fmod(hue, 360) + 360, 360), saturation, value});
+        }
+        GraphicsTools::ColorRgba8 colors[256];
+        GraphicsTools::hsv2rgb(hues, colors, 256);
+        for (int i = 0; i < 256; i++){
+            colorMap[i] = colors[i].argb();
+        }
+    }
+
+    void HeatmapChart::addColumn(const double* values){
+        double scale = (valueMax > valueMin) ? 255 / (valueMax - valueMin) : 0;
+        for (int row = 0; row < rows; row++){
+            // NaN (a NaN value, or an infinite one with an empty range)
+            // has no bin and is coloured as the lowest
+            double level = (values[row] - valueMin) * scale;
+            int index = std::isnan(level) ? 0 : std::clamp(level, 0.0, 255.0);
+            // the texture's first row is the top one
+            if (texture != NULL){
+                columnPixels[rows - 1 - row] = colorMap[index];
+            }
+            else {
+                cells[(size_t)nextColumn * rows + rows - 1 - row] = index;
+            }
+        }
+        if (texture != NULL){
+            SDL_Rect slot = {nextColumn, 0, 1, rows};
+            SDL_UpdateTexture(texture, &slot, columnPixels.data(), sizeof(Uint32));
+        }
+        nextColumn = (nextColumn + 1 == columns) ? 0 : nextColumn + 1;
+        filledColumns = std::min(filledColumns + 1, columns);
+    }
+
+    void HeatmapChart::clear(){
+        nextColumn = 0;
+        filledColumns = 0;
+    }
+
+    void HeatmapChart::drawCells(int firstSlot, int count, int x){
+        for (int i = 0; i < count; i++){
+            int left = drawPosX + (long)(x + i) * drawWidth / columns;
+            int right = drawPosX + (long)(x + i + 1) * drawWidth / columns;
+            const Uint8* column = &cells[(size_t)(firstSlot + i) * rows];
+            for (int row = 0; row < rows; row++){
+                int top = drawPosY + (long)row * drawHeight / rows;
+                int bottom = drawPosY + (long)(row + 1) * drawHeight / rows;
+                parentWindow->drawRectangle(GraphicsTools::ColorRgba8::fromArgb(colorMap[column[row]]),
+                                            left, top, right - left, bottom - top);
+            }
+        }
+    }
+
+    void HeatmapChart::draw(){
+        // the columns run from the oldest, which starts the ring once it is
+        // full, to the newest at the right edge; a full ring wraps, so it is
+        // drawn in two parts
+        int oldest = (filledColumns == columns) ? nextColumn : 0;
+        int firstCount = std::min(filledColumns, columns - oldest);
+        int parts[2][2] = {{oldest, firstCount}, {0, filledColumns - firstCount}};
+        int x = columns - filledColumns;
+        for (auto& part : parts){
+            if (part[1] == 0){
+                continue;
+            }
+            if (texture != NULL){
+                int left = drawPosX + (long)x * drawWidth / columns;
+                int right = drawPosX + (long)(x + part[1]) * drawWidth / columns;
+                parentWindow->drawImageRegion(texture, SDL_Rect({part[0], 0, part[1], rows}),
+                                              SDL_Rect({left, drawPosY, right - left, drawHeight}));
+            }
+            else {
+                drawCells(part[0], part[1], x);
+            }
+            x += part[1];
+        }
     }
 }
@@ -1,18 +1,55 @@
 #include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <random>
 
+#include "mbcapture.h"
 #include "mbgfx.h"
+#include "mbimage.h"
+#include "mbraster.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using std::cerr;
 
+// Render statistics. COUNT_CALLS adds to a counter of the current frame,
+// TIME_DRAW adds the time until the end of the enclosing scope to a timer.
+#ifdef MBGFX_STATS
+#define COUNT_CALLS(counter, n) (currentStats.counter += (n))
+#define TIME_DRAW(timer) DrawTimer drawTimer(currentStats.timer)
+#else
+#define COUNT_CALLS(counter, n)
+#define TIME_DRAW(timer)
+#endif
+
 namespace GraphicsTools {
 
-int InitGraphics() {
+#ifdef MBGFX_STATS
+namespace {
+class DrawTimer {
+public:
+  DrawTimer(double &t) : total(t), start(SDL_GetPerformanceCounter()) {}
+  ~DrawTimer() {
+    total += (double)(SDL_GetPerformanceCounter() - start) /
+             SDL_GetPerformanceFrequency();
+  }
+
+private:
+  double &total;
+  Uint64 start;
+};
+} // namespace
+#endif
+
+int InitGraphics(bool headless) {
   // Initialize SDL
-  int result = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
+  int result = SDL_Init(headless ? SDL_INIT_EVENTS
+                                 : (SDL_INIT_VIDEO | SDL_INIT_EVENTS));
   if (result == -1) {
     cerr << SDL_GetError() << "\n";
   }
@@ -107,6 +144,107 @@ ColorRgba hsv2rgb(ColorHsv in) {
   return out;
 }
 
+void blend(const ColorRgba8 *c1, double w1, const ColorRgba8 *c2, double w2,
+           ColorRgba8 *out, int count) {
+  // in fixed point: the weights become w1 and w2 in 256ths
+  double sum = w1 + w2;
+  int weight1 =
+      (sum > 0) ? (int)std::lround(256 * std::clamp(w1 / sum, 0.0, 1.0)) : 128;
+  int weight2 = 256 - weight1;
+  int i = 0;
+#ifdef __SSE2__
+  // four colours, as sixteen channels widened to 16 bits; a channel times
+  // its weight stays below 2^16
+  __m128i zero = _mm_setzero_si128();
+  __m128i mul1 = _mm_set1_epi16(weight1);
+  __m128i mul2 = _mm_set1_epi16(weight2);
+  for (; i + 4 <= count; i += 4) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(c1 + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(c2 + i));
+    __m128i lo = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), mul1),
+        _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), mul2));
+    __m128i hi = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), mul1),
+        _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), mul2));
+    _mm_storeu_si128((__m128i *)(out + i),
+                     _mm_packus_epi16(_mm_srli_epi16(lo, 8),
+                                      _mm_srli_epi16(hi, 8)));
+  }
+#endif
+  for (; i < count; i++) {
+    ColorRgba8 a = c1[i];
+    ColorRgba8 b = c2[i];
+    out[i].r = (a.r * weight1 + b.r * weight2) >> 8;
+    out[i].g = (a.g * weight1 + b.g * weight2) >> 8;
+    out[i].b = (a.b * weight1 + b.b * weight2) >> 8;
+    out[i].a = (a.a * weight1 + b.a * weight2) >> 8;
+  }
+}
+
+void hsv2rgb(const ColorHsv *in, ColorRgba8 *out, int count) {
+  int i = 0;
+#ifdef __SSE2__
+  // hsv2rgb for four colours, choosing each channel from v, p, q and t by
+  // the sector of the hue instead of branching
+  __m128 one = _mm_set1_ps(1);
+  __m128 zero = _mm_setzero_ps();
+  __m128 full = _mm_set1_ps(255);
+  __m128i alpha = _mm_set1_epi32(0xFF << 24);
+  for (; i + 4 <= count; i += 4) {
+    const ColorHsv *c = in + i;
+    __m128 h = _mm_setr_ps(c[0].h, c[1].h, c[2].h, c[3].h);
+    __m128 s = _mm_setr_ps(c[0].s, c[1].s, c[2].s, c[3].s);
+    __m128 v = _mm_setr_ps(c[0].v, c[1].v, c[2].v, c[3].v);
+    h = _mm_andnot_ps(_mm_cmpge_ps(h, _mm_set1_ps(360)), h);
+    // divided rather than multiplied by a rounded 1/60, so that hues on a
+    // sector boundary land in the same sector as in hsv2rgb
+    h = _mm_div_ps(h, _mm_set1_ps(60));
+    __m128i sector = _mm_cvttps_epi32(h);
+    __m128 ff = _mm_sub_ps(h, _mm_cvtepi32_ps(sector));
+    __m128 p = _mm_mul_ps(v, _mm_sub_ps(one, s));
+    __m128 q = _mm_mul_ps(v, _mm_sub_ps(one, _mm_mul_ps(s, ff)));
+    __m128 t =
+        _mm_mul_ps(v, _mm_sub_ps(one, _mm_mul_ps(s, _mm_sub_ps(one, ff))));
+
+    __m128 in0 = _mm_castsi128_ps(_mm_cmpeq_epi32(sector, _mm_set1_epi32(0)));
+    __m128 in1 = _mm_castsi128_ps(_mm_cmpeq_epi32(sector, _mm_set1_epi32(1)));
+    __m128 in2 = _mm_castsi128_ps(_mm_cmpeq_epi32(sector, _mm_set1_epi32(2)));
+    __m128 in3 = _mm_castsi128_ps(_mm_cmpeq_epi32(sector, _mm_set1_epi32(3)));
+    __m128 in4 = _mm_castsi128_ps(_mm_cmpeq_epi32(sector, _mm_set1_epi32(4)));
+    auto select = [](__m128 mask, __m128 x, __m128 y) {
+      return _mm_or_ps(_mm_and_ps(mask, x), _mm_andnot_ps(mask, y));
+    };
+    // sectors 0 to 4, then the default of the switch above
+    __m128 r =
+        select(in1, q, select(_mm_or_ps(in2, in3), p, select(in4, t, v)));
+    __m128 g =
+        select(in0, t, select(_mm_or_ps(in1, in2), v, select(in3, q, p)));
+    __m128 b = select(_mm_or_ps(in0, in1), p,
+                      select(in2, t, select(_mm_or_ps(in3, in4), v, q)));
+    __m128 grey = _mm_cmple_ps(s, zero);
+    r = select(grey, v, r);
+    g = select(grey, v, g);
+    b = select(grey, v, b);
+
+    // channel c is byte c of each colour; NaN becomes 0, as max gives its
+    // second operand when either is NaN
+    __m128i px = alpha;
+    __m128 channels[3] = {r, g, b};
+    for (int k = 0; k < 3; k++) {
+      __m128 x =
+          _mm_min_ps(_mm_max_ps(_mm_mul_ps(channels[k], full), zero), full);
+      px = _mm_or_si128(px, _mm_slli_epi32(_mm_cvttps_epi32(x), 8 * k));
+    }
+    _mm_storeu_si128((__m128i *)(out + i), px);
+  }
+#endif
+  for (; i < count; i++) {
+    ColorRgba c = hsv2rgb(in[i]);
+    out[i] = ColorRgba8(c.r * 255, c.g * 255, c.b * 255);
+  }
+}
+
 ColorRgba randomColor() {
   std::default_random_engine generator;
   generator.seed(std::chrono::system_clock::now().time_since_epoch().count());
@@ -125,6 +263,8 @@ ColorRgba randomColor() {
 }
 
 Font::Font(const char *fontFile, int fontSize) : size(fontSize) {
+  static unsigned int nextId = 0;
+  _id = nextId++;
   filename = fontFile;
   f = TTF_OpenFont(fontFile, fontSize);
   if (f == NULL) {
@@ -134,139 +274,999 @@ Font::Font(const char *fontFile, int fontSize) : size(fontSize) {
 
 Font::~Font() { TTF_CloseFont(f); }
 
-Window::Window(std::string n, int width, int height)
-    : name(n), _width(width), _height(height) {
+TextureCache::TextureCache(size_t byteBudget)
+    : budget(byteBudget), used(0), destroyedCount(0) {}
 
-  // Initialize window
-  win = SDL_CreateWindow(name.c_str(), SDL_WINDOWPOS_CENTERED,
-                         SDL_WINDOWPOS_CENTERED, _width, _height,
-                         SDL_WINDOW_SHOWN);
-  if (win == NULL) {
-    cerr << SDL_GetError() << "\n";
+TextureCache::~TextureCache() { clear(); }
+
+const CachedTexture *TextureCache::find(const std::string &key) {
+  auto it = index.find(key);
+  if (it == index.end()) {
+    return NULL;
+  }
+  entries.splice(entries.begin(), entries, it->second);
+  return &it->second->second;
+}
+
+const CachedTexture *TextureCache::insert(const std::string &key,
+                                          SDL_Texture *texture, int w, int h) {
+  auto it = index.find(key);
+  if (it != index.end()) {
+    used -= (size_t)it->second->second.w * it->second->second.h * 4;
+    destroy(it->second->second);
+    entries.erase(it->second);
+    index.erase(it);
+  }
+  // evict from the old end, but always keep the newest entry
+  size_t bytes = (size_t)w * h * 4;
+  evict(bytes);
+  entries.push_front({key, CachedTexture({texture, w, h, 0})});
+  index[key] = entries.begin();
+  used += bytes;
+  return &entries.front().second;
+}
+
+void TextureCache::pin(const std::string &key) {
+  auto it = index.find(key);
+  if (it != index.end()) {
+    it->second->second.pins++;
+  }
+}
+
+void TextureCache::unpin(const std::string &key) {
+  auto it = index.find(key);
+  if (it != index.end() && it->second->second.pins > 0) {
+    it->second->second.pins--;
+    if (it->second->second.pins == 0) {
+      evict(0);
+    }
+  }
+}
+
+void TextureCache::setBudget(size_t byteBudget) {
+  budget = byteBudget;
+  evict(0);
+}
+
+void TextureCache::evict(size_t bytes) {
+  auto it = entries.end();
+  while (it != entries.begin() && used + bytes > budget) {
+    --it;
+    if (it->second.pins > 0) {
+      continue;
+    }
+    used -= (size_t)it->second.w * it->second.h * 4;
+    destroy(it->second);
+    index.erase(it->first);
+    it = entries.erase(it);
+  }
+}
+
+void TextureCache::destroy(const CachedTexture &entry) {
+  if (destroyCallback) {
+    destroyCallback(entry.texture);
+  }
+  SDL_DestroyTexture(entry.texture);
+  destroyedCount++;
+}
+
+void TextureCache::clear() {
+  for (auto &entry : entries) {
+    destroy(entry.second);
+  }
+  entries.clear();
+  index.clear();
+  used = 0;
+}
+
+void FrameHistogram::add(double seconds) {
+  int i = std::min((int)(seconds / binWidth), binCount - 1);
+  bins[std::max(i, 0)]++;
+  total++;
+  sum += seconds;
+  longest = std::max(longest, seconds);
+}
+
+void FrameHistogram::reset() {
+  std::fill(bins, bins + binCount, 0);
+  total = 0;
+  sum = 0;
+  longest = 0;
+}
+
+double FrameHistogram::percentile(double p) const {
+  if (total == 0) {
+    return 0;
+  }
+  int needed = std::max(1, (int)std::ceil(p * total));
+  int seen = 0;
+  for (int i = 0; i < binCount; i++) {
+    seen += bins[i];
+    if (seen >= needed) {
+      return (i + 1) * binWidth;
+    }
+  }
+  return binCount * binWidth;
+}
+
+Window::Window(std::string n, int width, int height, WindowMode mode,
+               RenderBackend backend)
+    : ren(NULL), name(n), _height(height), _width(width), win(NULL),
+      surface(NULL), recorder(NULL), frameNumber(0), originX(0), originY(0),
+      drawColorSet(false), drawBlendMode(SDL_BLENDMODE_INVALID),
+      textCache(8 << 20), spriteCache(16 << 20), imageCache(64 << 20),
+      pacing(VSync), framePeriod(0), nextFrame(0), frameStart(0),
+      lastPresent(0), frameRequested(false), currentStats(), lastStats(),
+      cacheDestroyed(0), raster(NULL), rasterTexture(NULL),
+      rasterTextBytes(0) {
+
+  if (mode == Offscreen) {
+    // Initialize framebuffer and software renderer
+    surface = SDL_CreateRGBSurfaceWithFormat(0, _width, _height, 32,
+                                             SDL_PIXELFORMAT_RGBA32);
+    if (surface == NULL) {
+      cerr << SDL_GetError() << "\n";
+    } else {
+      ren = SDL_CreateSoftwareRenderer(surface);
+      if (ren == NULL) {
+        cerr << SDL_GetError() << "\n";
+      }
+    }
   } else {
-    // Initialize renderer
-    ren = SDL_CreateRenderer(
-        win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    if (ren == NULL) {
+    // Initialize window
+    win = SDL_CreateWindow(name.c_str(), SDL_WINDOWPOS_CENTERED,
+                           SDL_WINDOWPOS_CENTERED, _width, _height,
+                           SDL_WINDOW_SHOWN);
+    if (win == NULL) {
       cerr << SDL_GetError() << "\n";
+    } else {
+      // Initialize renderer
+      ren = SDL_CreateRenderer(
+          win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+      if (ren == NULL) {
+        cerr << SDL_GetError() << "\n";
+      }
     }
   }
+
+  if (backend == TiledRaster && ren != NULL) {
+    startRaster();
+  }
+  imageCache.setDestroyCallback([this](SDL_Texture *tex) {
+    imageNames.erase(tex);
+    rasterImages.erase(tex);
+  });
+}
+
+void Window::startRaster() {
+  // without a texture to upload to, stay with the SDL renderer
+  rasterTexture = SDL_CreateTexture(ren, SDL_PIXELFORMAT_ARGB8888,
+                                    SDL_TEXTUREACCESS_STREAMING, _width,
+                                    _height);
+  COUNT_CALLS(textureCreates, 1);
+  if (rasterTexture == NULL) {
+    cerr << "cannot create framebuffer texture: " << SDL_GetError() << "\n";
+    return;
+  }
+  SDL_SetTextureBlendMode(rasterTexture, SDL_BLENDMODE_NONE);
+  raster = new TileRasterizer(_width, _height);
 }
 
 Window::~Window() {
+  delete recorder;
+  delete raster;
+  if (rasterTexture != NULL) {
+    SDL_DestroyTexture(rasterTexture);
+  }
+  // cached textures belong to the renderer, so go first
+  textCache.clear();
+  spriteCache.clear();
+  imageCache.clear();
   SDL_DestroyRenderer(ren);
-  SDL_DestroyWindow(win);
+  if (win != NULL) {
+    SDL_DestroyWindow(win);
+  }
+  if (surface != NULL) {
+    SDL_FreeSurface(surface);
+  }
 }
 
-void Window::update() { SDL_RenderPresent(ren); }
+void Window::update() {
+  if (!preloads.empty()) {
+    uploadPreloads();
+  }
+  if (raster != NULL) {
+    raster->render();
+    SDL_UpdateTexture(rasterTexture, NULL, raster->pixels(), raster->pitch());
+    SDL_RenderCopy(ren, rasterTexture, NULL, NULL);
+    COUNT_CALLS(renderCopies, 1);
+  }
+  if (recorder != NULL) {
+    // the back buffer is only defined until it is presented
+    Uint8 *frame = recorder->acquire();
+    if (frame != NULL) {
+      if (readFrame(frame, _width * 4) == 0) {
+        recorder->submit(frame, frameNumber);
+      } else {
+        recorder->release(frame);
+      }
+    }
+    frameNumber++;
+  }
+  SDL_RenderPresent(ren);
+  Uint64 now = SDL_GetPerformanceCounter();
+  double frequency = SDL_GetPerformanceFrequency();
+  if (lastPresent != 0) {
+    intervals.add((now - lastPresent) / frequency);
+  }
+  if (frameStart != 0) {
+    workTimes.add((now - frameStart) / frequency);
+    frameStart = 0;
+  }
+  lastPresent = now;
+#ifdef MBGFX_STATS
+  int destroyed =
+      textCache.destroyed() + spriteCache.destroyed() + imageCache.destroyed();
+  COUNT_CALLS(textureDestroys, destroyed - cacheDestroyed);
+  cacheDestroyed = destroyed;
+  lastStats = currentStats;
+  currentStats = RenderStats();
+  if (statsCallback) {
+    statsCallback(lastStats);
+  }
+#endif
+}
+
+int Window::setPresentMode(PresentMode mode, double fps) {
+  pacing = mode;
+  framePeriod =
+      (mode == FixedRate && fps > 0) ? SDL_GetPerformanceFrequency() / fps : 0;
+  nextFrame = 0;
+  if (win == NULL || ren == NULL) {
+    return 0;
+  }
+  if (SDL_RenderSetVSync(ren, mode == VSync || mode == OnDemand) != 0) {
+    cerr << "cannot set vsync: " << SDL_GetError() << "\n";
+    return -1;
+  }
+  return 0;
+}
+
+bool Window::waitFrame(int timeoutMs) {
+  if (pacing == OnDemand) {
+    Uint32 start = SDL_GetTicks();
+    while (!frameRequested.exchange(false)) {
+      int left = timeoutMs - (int)(SDL_GetTicks() - start);
+      if (left <= 0) {
+        return false;
+      }
+      // a request from another thread doesn't end the wait for events, so
+      // wait in short slices
+      if (SDL_WaitEventTimeout(NULL, std::min(left, 5)) != 0) {
+        return false;
+      }
+    }
+  } else if (pacing == FixedRate && framePeriod > 0) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (nextFrame == 0 || now > nextFrame + framePeriod) {
+      nextFrame = now;
+    }
+    // sleeps overshoot by up to a millisecond or so; spin for the last 2
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 spin = frequency / 500;
+    while (now + spin < nextFrame) {
+      SDL_Delay((Uint32)((nextFrame - spin - now) * 1000 / frequency));
+      now = SDL_GetPerformanceCounter();
+    }
+    while (now < nextFrame) {
+      now = SDL_GetPerformanceCounter();
+    }
+    nextFrame += framePeriod;
+  }
+  frameStart = SDL_GetPerformanceCounter();
+  return true;
+}
+
+void Window::resetFrameTimes() {
+  intervals.reset();
+  workTimes.reset();
+  lastPresent = 0;
+}
+
+SDL_Surface *Window::frameSurface(bool *owned) {
+  if (surface != NULL && raster == NULL) {
+    // the software renderer batches commands; make sure they have landed
+    SDL_RenderFlush(ren);
+    *owned = false;
+    return surface;
+  }
+  *owned = true;
+  SDL_Surface *frame = SDL_CreateRGBSurfaceWithFormat(0, _width, _height, 32,
+                                                      SDL_PIXELFORMAT_RGBA32);
+  if (frame == NULL) {
+    cerr << SDL_GetError() << "\n";
+    return NULL;
+  }
+  if (readFrame(frame->pixels, frame->pitch) != 0) {
+    SDL_FreeSurface(frame);
+    return NULL;
+  }
+  return frame;
+}
+
+int Window::readFrame(void *pixels, int pitch) {
+  if (raster != NULL) {
+    // the frame is whatever has been recorded, rasterized now
+    raster->render();
+    return SDL_ConvertPixels(_width, _height, SDL_PIXELFORMAT_ARGB8888,
+                             raster->pixels(), raster->pitch(),
+                             SDL_PIXELFORMAT_RGBA32, pixels, pitch);
+  }
+  if (surface != NULL) {
+    SDL_RenderFlush(ren);
+    return SDL_ConvertPixels(_width, _height, SDL_PIXELFORMAT_RGBA32,
+                             surface->pixels, surface->pitch,
+                             SDL_PIXELFORMAT_RGBA32, pixels, pitch);
+  }
+  if (SDL_RenderReadPixels(ren, NULL, SDL_PIXELFORMAT_RGBA32, pixels, pitch) !=
+      0) {
+    cerr << "cannot read frame: " << SDL_GetError() << "\n";
+    return -1;
+  }
+  return 0;
+}
+
+int Window::startCapture(std::string path, CaptureFormat format,
+                         int buffers) {
+  stopCapture();
+  if (ren == NULL) {
+    return -1;
+  }
+  recorder = new FrameRecorder(path, format, _width, _height, buffers);
+  if (!recorder->good()) {
+    stopCapture();
+    return -1;
+  }
+  frameNumber = 0;
+  return 0;
+}
+
+void Window::stopCapture() {
+  delete recorder;
+  recorder = NULL;
+}
+
+int Window::capturedFrames() const {
+  return recorder ? recorder->written() : 0;
+}
+
+int Window::droppedFrames() const {
+  return recorder ? recorder->dropped() : 0;
+}
+
+int Window::savePNG(std::string filename) {
+  bool owned;
+  SDL_Surface *frame = frameSurface(&owned);
+  if (frame == NULL) {
+    return -1;
+  }
+  int result = IMG_SavePNG(frame, filename.c_str());
+  if (result != 0) {
+    cerr << "cannot save " << filename << ": " << SDL_GetError() << "\n";
+  }
+  if (owned) {
+    SDL_FreeSurface(frame);
+  }
+  return result;
+}
+
+int Window::saveRaw(std::string filename) {
+  bool owned;
+  SDL_Surface *frame = frameSurface(&owned);
+  if (frame == NULL) {
+    return -1;
+  }
+  int result = 0;
+  FILE *out = fopen(filename.c_str(), "wb");
+  if (out == NULL) {
+    cerr << "cannot open " << filename << "\n";
+    result = -1;
+  } else {
+    size_t rowBytes = (size_t)frame->w * 4;
+    for (int row = 0; row < frame->h && result == 0; row++) {
+      if (fwrite((const char *)frame->pixels + (size_t)row * frame->pitch, 1,
+                 rowBytes, out) != rowBytes) {
+        cerr << "cannot write " << filename << "\n";
+        result = -1;
+      }
+    }
+    fclose(out);
+  }
+  if (owned) {
+    SDL_FreeSurface(frame);
+  }
+  return result;
+}
 
 SDL_Texture *Window::loadImage(std::string fileName) {
-  SDL_Texture *tex = IMG_LoadTexture(ren, fileName.c_str());
+  const CachedTexture *cached = imageCache.find(fileName);
+  if (cached == NULL) {
+    if (ren == NULL) {
+      return NULL;
+    }
+    if (!imageLoader) {
+      imageLoader = ImageLoader::shared();
+    }
+    bool failed;
+    std::shared_ptr<SDL_Surface> surf =
+        imageLoader->take(fileName, true, &failed);
+    if (surf == NULL) {
+      return NULL; // the loader has reported why
+    }
+    cached = uploadImage(fileName, surf.get());
+    if (cached == NULL) {
+      return NULL;
+    }
+  }
+  imageCache.pin(fileName);
+  return cached->texture;
+}
+
+void Window::releaseImage(SDL_Texture *img) {
+  auto it = imageNames.find(img);
+  if (it != imageNames.end()) {
+    std::string fileName = it->second; // unpinning may evict the entry
+    imageCache.unpin(fileName);
+  }
+}
+
+void Window::preloadImage(std::string fileName) {
+  if (ren == NULL || imageCache.find(fileName) != NULL) {
+    return;
+  }
+  if (!imageLoader) {
+    imageLoader = ImageLoader::shared();
+  }
+  imageLoader->request(fileName);
+  preloads.push_back(fileName);
+}
+
+void Window::uploadPreloads() {
+  auto it = preloads.begin();
+  while (it != preloads.end()) {
+    if (imageCache.find(*it) == NULL) {
+      bool failed;
+      std::shared_ptr<SDL_Surface> surf = imageLoader->take(*it, false, &failed);
+      if (surf == NULL && !failed) {
+        it++; // still decoding
+        continue;
+      }
+      if (surf != NULL) {
+        uploadImage(*it, surf.get());
+      }
+    }
+    it = preloads.erase(it);
+  }
+}
+
+const CachedTexture *Window::uploadImage(const std::string &fileName,
+                                         SDL_Surface *surf) {
+  SDL_Texture *tex = SDL_CreateTextureFromSurface(ren, surf);
+  COUNT_CALLS(textureCreates, 1);
   if (tex == NULL) {
     std::cout << SDL_GetError() << "\n";
+    return NULL;
   }
-  return tex;
+  if (raster != NULL) {
+    // the texture is the handle; the rasterizer draws the pixels kept here
+    std::shared_ptr<RasterImage> image = MakeRasterImage(surf);
+    if (image == NULL) {
+      std::cout << SDL_GetError() << "\n";
+      SDL_DestroyTexture(tex);
+      return NULL;
+    }
+    rasterImages[tex] = image;
+  }
+  imageNames[tex] = fileName;
+  return imageCache.insert(fileName, tex, surf->w, surf->h);
 }
 
 void Window::drawImage(SDL_Texture *img, int x, int y, int alpha) {
+  TIME_DRAW(drawImageTime);
+  if (raster != NULL) {
+    auto it = rasterImages.find(img);
+    if (it != rasterImages.end()) {
+      raster->drawImage(it->second, x - originX, y - originY, alpha);
+    }
+    return;
+  }
   SDL_Rect pos;
-  pos.x = x;
-  pos.y = y;
+  pos.x = x - originX;
+  pos.y = y - originY;
 
   SDL_QueryTexture(img, NULL, NULL, &pos.w, &pos.h);
   SDL_SetTextureBlendMode(img, SDL_BLENDMODE_BLEND);
   SDL_SetTextureAlphaMod(img, alpha);
   SDL_RenderCopy(ren, img, NULL, &pos);
+  COUNT_CALLS(renderCopies, 1);
+}
+
+SDL_Texture *Window::createStreamingImage(int w, int h) {
+  if (raster != NULL) {
+    return NULL; // the rasterizer couldn't see what is written to it
+  }
+  SDL_Texture *tex = SDL_CreateTexture(ren, SDL_PIXELFORMAT_ARGB8888,
+                                       SDL_TEXTUREACCESS_STREAMING, w, h);
+  COUNT_CALLS(textureCreates, 1);
+  if (tex == NULL) {
+    std::cerr << "cannot create texture: " << SDL_GetError() << "\n";
+  }
+  return tex;
+}
+
+void Window::drawImageRegion(SDL_Texture *img, SDL_Rect src, SDL_Rect dst) {
+  TIME_DRAW(drawImageTime);
+  dst.x -= originX;
+  dst.y -= originY;
+  SDL_RenderCopy(ren, img, &src, &dst);
+  COUNT_CALLS(renderCopies, 1);
+}
+
+void Window::setDrawColor(ColorRgba8 color) {
+  if (!drawColorSet || color != drawColor) {
+    SDL_SetRenderDrawColor(ren, color.r, color.g, color.b, color.a);
+    COUNT_CALLS(colorChanges, 1);
+    drawColor = color;
+    drawColorSet = true;
+  }
 }
 
-void Window::clear() { SDL_RenderClear(ren); }
+void Window::setDrawBlendMode(SDL_BlendMode mode) {
+  if (mode != drawBlendMode) {
+    SDL_SetRenderDrawBlendMode(ren, mode);
+    drawBlendMode = mode;
+  }
+}
+
+// the rasterizer's shapes are opaque, like the window's
+static SDL_Color opaque(ColorRgba8 color) {
+  return {color.r, color.g, color.b, 255};
+}
 
-void Window::drawRectangle(GraphicsTools::ColorRgba color, int x, int y, int w,
+void Window::clear() {
+  if (raster != NULL) {
+    raster->clear(opaque(Colors::Black));
+    return;
+  }
+  // the draw colour is whatever was drawn with last
+  setDrawColor(Colors::Black);
+  SDL_RenderClear(ren);
+}
+
+void Window::drawRectangle(GraphicsTools::ColorRgba8 color, int x, int y, int w,
                            int h) {
-  SDL_SetRenderDrawColor(ren, color.r, color.g, color.b, color.a);
+  TIME_DRAW(drawRectangleTime);
+  if (raster != NULL) {
+    raster->fillRect(opaque(color), x - originX, y - originY, w, h);
+    return;
+  }
+  color.a = shapeAlpha(color.a);
+  setDrawColor(color);
+  setDrawBlendMode(SDL_BLENDMODE_NONE);
   SDL_Rect target;
-  target.x = x;
-  target.y = y;
+  target.x = x - originX;
+  target.y = y - originY;
   target.w = w;
   target.h = h;
   SDL_RenderFillRect(ren, &target);
-  SDL_SetRenderDrawColor(ren, 0, 0, 0, 255);
+  COUNT_CALLS(fillRects, 1);
 }
 
-void Window::drawCircle(GraphicsTools::ColorRgba color, int x, int y, int r) {
-  SDL_SetRenderDrawColor(ren, color.r, color.g, color.b, color.a);
-  for (int _y = y - r; _y <= y + r; _y++) {
-    int w = sqrt((r * r) - ((_y - y) * (_y - y)) - r);
-    SDL_RenderDrawLine(ren, x - w, _y, x + w, _y);
+// Fills one row of a circle sprite: the pixels within w of the centre get
+// a blend of the two colours weighted by their whole-pixel distance d from
+// the centre, as (outer * d + inner * (r - d)) / r, and are opaque like a
+// solid shape on the window. SSE2 does four pixels at a time.
+static void rasterizeCircleRow(Uint8 *row, int w, int dy, int r,
+                               const float outer[3], const float inner[3]) {
+  float rf = r;
+  int dx = -w;
+#ifdef __SSE2__
+  __m128 rv = _mm_set1_ps(rf);
+  __m128i alpha = _mm_set1_epi32(0xFF << 24);
+  for (; dx + 3 <= w; dx += 4) {
+    __m128i n = _mm_setr_epi32(dx * dx + dy * dy, (dx + 1) * (dx + 1) + dy * dy,
+                               (dx + 2) * (dx + 2) + dy * dy,
+                               (dx + 3) * (dx + 3) + dy * dy);
+    __m128 d = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(n))));
+    __m128 rest = _mm_sub_ps(rv, d);
+    __m128i px = alpha;
+    for (int c = 0; c < 3; c++) {
+      __m128 v = _mm_div_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(outer[c]), d),
+                                       _mm_mul_ps(_mm_set1_ps(inner[c]), rest)),
+                            rv);
+      // RGBA32 is R, G, B, A in memory: channel c is byte c of each pixel
+      px = _mm_or_si128(px, _mm_slli_epi32(_mm_cvttps_epi32(v), 8 * c));
+    }
+    _mm_storeu_si128((__m128i *)(row + 4 * dx), px);
+  }
+#endif
+  for (; dx <= w; dx++) {
+    float d = (int)sqrtf((float)(dx * dx + dy * dy));
+    Uint8 *px = row + 4 * dx;
+    for (int c = 0; c < 3; c++) {
+      px[c] = (outer[c] * d + inner[c] * (rf - d)) / rf;
+    }
+    px[3] = 255;
   }
-  SDL_SetRenderDrawColor(ren, 0, 0, 0, 255);
 }
 
-void Window::drawCircleGradient(GraphicsTools::ColorRgba outer,
-                                GraphicsTools::ColorRgba inner, int x, int y,
-                                int r) {
-  for (int _y = y - r; _y <= y + r; _y++) {
-    int w = sqrt(pow(r, 2) - pow(_y - y, 2) - r);
-    for (int _x = x - w; _x <= x + w; _x++) {
-      int d = sqrt(pow(abs(x - _x), 2) + pow(abs(y - _y), 2));
-      ColorRgba pointColor = blend(outer, d, inner, r - d);
-      SDL_SetRenderDrawColor(ren, pointColor.r, pointColor.g, pointColor.b,
-                             pointColor.a);
-      SDL_RenderDrawPoint(ren, _x, _y);
+const CachedTexture *Window::circleSprite(ColorRgba8 outer, ColorRgba8 inner,
+                                          int r) {
+  // alpha is left out of the key, as the circle is opaque
+  Uint8 key[10] = {outer.r, outer.g, outer.b, inner.r, inner.g, inner.b};
+  memcpy(key + 6, &r, sizeof(r));
+  std::string keyString((const char *)key, sizeof(key));
+  const CachedTexture *cached = spriteCache.find(keyString);
+  if (cached != NULL) {
+    return cached;
+  }
+
+  int size = 2 * r + 1;
+  SDL_Surface *surf =
+      SDL_CreateRGBSurfaceWithFormat(0, size, size, 32, SDL_PIXELFORMAT_RGBA32);
+  if (surf == NULL) {
+    cerr << "cannot create circle: " << SDL_GetError() << "\n";
+    return NULL;
+  }
+  memset(surf->pixels, 0, (size_t)surf->pitch * size);
+  float outerf[3] = {(float)key[0], (float)key[1], (float)key[2]};
+  float innerf[3] = {(float)key[3], (float)key[4], (float)key[5]};
+  for (int dy = -r; dy <= r; dy++) {
+    // rows follow the shape the circles have always been drawn with
+    int w2 = r * r - dy * dy - r;
+    if (w2 < 0) {
+      continue;
     }
+    int w = sqrt(w2);
+    Uint8 *centre = (Uint8 *)surf->pixels + (size_t)(dy + r) * surf->pitch +
+                    4 * r;
+    rasterizeCircleRow(centre, w, dy, r, outerf, innerf);
   }
-  SDL_SetRenderDrawColor(ren, 0, 0, 0, 255);
+
+  SDL_Texture *texture = SDL_CreateTextureFromSurface(ren, surf);
+  COUNT_CALLS(textureCreates, 1);
+  SDL_FreeSurface(surf);
+  if (texture == NULL) {
+    cerr << "cannot create circle: " << SDL_GetError() << "\n";
+    return NULL;
+  }
+  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+  return spriteCache.insert(keyString, texture, size, size);
+}
+
+void Window::drawCircle(GraphicsTools::ColorRgba8 color, int x, int y, int r) {
+  TIME_DRAW(drawCircleTime);
+  drawCircleSprite(color, color, x, y, r);
+}
+
+void Window::drawCircleGradient(GraphicsTools::ColorRgba8 outer,
+                                GraphicsTools::ColorRgba8 inner, int x, int y,
+                                int r) {
+  TIME_DRAW(drawCircleGradientTime);
+  drawCircleSprite(outer, inner, x, y, r);
+}
+
+void Window::drawCircleSprite(ColorRgba8 outer, ColorRgba8 inner, int x,
+                              int y, int r) {
+  if (r <= 0) {
+    return;
+  }
+  if (raster != NULL) {
+    raster->drawCircle(opaque(outer), opaque(inner), x - originX, y - originY,
+                       r);
+    return;
+  }
+  const CachedTexture *sprite = circleSprite(outer, inner, r);
+  if (sprite == NULL) {
+    return;
+  }
+  SDL_Rect pos;
+  pos.x = x - r - originX;
+  pos.y = y - r - originY;
+  pos.w = sprite->w;
+  pos.h = sprite->h;
+  SDL_RenderCopy(ren, sprite->texture, NULL, &pos);
+  COUNT_CALLS(renderCopies, 1);
 }
+
 void Window::drawText(std::string text, GraphicsTools::Font *font,
-                      GraphicsTools::ColorRgba color, int x, int y,
+                      GraphicsTools::ColorRgba8 color, int x, int y,
                       GraphicsTools::TextAlignModeH al) {
+  TIME_DRAW(drawTextTime);
 
-  int alignmentShift = 0;
+  SDL_Color textColor = {color.r, color.g, color.b, color.a};
 
-  // We need to first render to a surface as that's what TTF_RenderText returns,
-  // then load that surface into a texture
-  SDL_Surface *surf = TTF_RenderText_Blended(
-      font->font(), text.c_str(),
-      SDL_Color({(unsigned char)color.r, (unsigned char)color.g,
-                 (unsigned char)color.b, (unsigned char)color.a}));
-  if (surf == NULL) {
-    std::cerr << "surface is null: " << SDL_GetError() << "\n";
+  // cache key: font id and colour bytes, then the text itself
+  std::string key;
+  key.reserve(sizeof(unsigned int) + sizeof(SDL_Color) + text.size());
+  unsigned int fontId = font->id();
+  key.append((const char *)&fontId, sizeof(fontId));
+  key.append((const char *)&textColor, sizeof(textColor));
+  key.append(text);
+
+  if (raster != NULL) {
+    drawRasterText(key, text, font, textColor, x, y, al);
+    return;
   }
-  SDL_Texture *texture = SDL_CreateTextureFromSurface(ren, surf);
-  if (texture == NULL) {
-    std::cerr << "texture is null: " << SDL_GetError() << "\n";
+
+  const CachedTexture *cached = textCache.find(key);
+  if (cached == NULL) {
+    // We need to first render to a surface as that's what TTF_RenderText
+    // returns, then load that surface into a texture
+    SDL_Surface *surf =
+        TTF_RenderText_Blended(font->font(), text.c_str(), textColor);
+    COUNT_CALLS(textRasterizations, 1);
+    if (surf == NULL) {
+      std::cerr << "surface is null: " << SDL_GetError() << "\n";
+      return;
+    }
+    SDL_Texture *texture = SDL_CreateTextureFromSurface(ren, surf);
+    COUNT_CALLS(textureCreates, 1);
+    if (texture == NULL) {
+      std::cerr << "texture is null: " << SDL_GetError() << "\n";
+      SDL_FreeSurface(surf);
+      return;
+    }
+    cached = textCache.insert(key, texture, surf->w, surf->h);
+    SDL_FreeSurface(surf);
   }
 
   // shift the x-coordinate based on the text alignment
+  int alignmentShift = 0;
   if (al == Center) {
-    TTF_SizeText(font->font(), text.c_str(), &alignmentShift, NULL);
-    alignmentShift = alignmentShift / 2;
+    alignmentShift = cached->w / 2;
   } else if (al == Right) {
-    TTF_SizeText(font->font(), text.c_str(), &alignmentShift, NULL);
+    alignmentShift = cached->w;
   }
 
   SDL_Rect pos;
-  pos.x = x - alignmentShift;
-  pos.y = y;
-  SDL_QueryTexture(texture, NULL, NULL, &pos.w, &pos.h);
+  pos.x = x - alignmentShift - originX;
+  pos.y = y - originY;
+  pos.w = cached->w;
+  pos.h = cached->h;
 
-  SDL_RenderCopy(ren, texture, NULL, &pos);
+  SDL_RenderCopy(ren, cached->texture, NULL, &pos);
+  COUNT_CALLS(renderCopies, 1);
+}
 
-  // Clean up the surface and font
-  SDL_DestroyTexture(texture);
-  SDL_FreeSurface(surf);
+void Window::drawRasterText(const std::string &key, const std::string &text,
+                            Font *font, SDL_Color color, int x, int y,
+                            TextAlignModeH al) {
+  std::shared_ptr<RasterImage> image;
+  auto it = rasterText.find(key);
+  if (it != rasterText.end()) {
+    image = it->second;
+  } else {
+    SDL_Surface *surf = TTF_RenderText_Blended(font->font(), text.c_str(), color);
+    COUNT_CALLS(textRasterizations, 1);
+    if (surf == NULL) {
+      std::cerr << "surface is null: " << SDL_GetError() << "\n";
+      return;
+    }
+    image = MakeRasterImage(surf);
+    SDL_FreeSurface(surf);
+    if (image == NULL) {
+      return;
+    }
+    // start over when full; strings recorded this frame keep their pixels
+    size_t bytes = image->pixels.size() * 4;
+    if (rasterTextBytes + bytes > (8 << 20)) {
+      rasterText.clear();
+      rasterTextBytes = 0;
+    }
+    rasterText[key] = image;
+    rasterTextBytes += bytes;
+  }
+
+  int alignmentShift = 0;
+  if (al == Center) {
+    alignmentShift = image->w / 2;
+  } else if (al == Right) {
+    alignmentShift = image->w;
+  }
+  raster->drawImage(image, x - alignmentShift - originX, y - originY, 255);
 }
 
-void Window::drawLine(GraphicsTools::ColorRgba color, int thickness, int x1,
+void Window::drawLine(GraphicsTools::ColorRgba8 color, int thickness, int x1,
                       int y1, int x2, int y2) {
-  SDL_SetRenderDrawColor(ren, color.r, color.g, color.b, color.a);
-  for (int dy = -thickness / 2; dy <= thickness / 2; dy++) {
-    int w = sqrt(pow(thickness / 2, 2) - pow(dy, 2));
-    for (int dx = -w; dx <= w; dx++) {
-      SDL_RenderDrawLine(ren, x1 + dx, y1 + dy, x2 + dx, y2 + dy);
+  TIME_DRAW(drawLineTime);
+  if (raster != NULL && thickness <= 1) {
+    // SDL draws thin lines through pixel centres
+    raster->drawLine(opaque(color), 1,
+                     x1 - originX + 0.5f, y1 - originY + 0.5f,
+                     x2 - originX + 0.5f, y2 - originY + 0.5f);
+    return;
+  }
+  if (thickness > 1) {
+    SDL_FPoint ends[2] = {{(float)x1, (float)y1}, {(float)x2, (float)y2}};
+    drawPolyline(color, thickness, ends, 2);
+    return;
+  }
+  color.a = shapeAlpha(color.a);
+  setDrawColor(color);
+  setDrawBlendMode(SDL_BLENDMODE_NONE);
+  SDL_RenderDrawLine(ren, x1 - originX, y1 - originY, x2 - originX,
+                     y2 - originY);
+  COUNT_CALLS(lines, 1);
+}
+
+void Window::drawPolyline(GraphicsTools::ColorRgba8 color, int thickness,
+                          const SDL_FPoint *points, int count) {
+  TIME_DRAW(drawPolylineTime);
+  SDL_Color c = {color.r, color.g, color.b, shapeAlpha(color.a)};
+  float halfWidth = std::max(thickness, 1) / 2.0f;
+  if (raster != NULL) {
+    for (int i = 1; i < count; i++) {
+      raster->drawLine(c, 2 * halfWidth, points[i - 1].x - originX,
+                       points[i - 1].y - originY, points[i].x - originX,
+                       points[i].y - originY);
     }
+    return;
+  }
+  // geometry without a texture blends with the draw blend mode
+  setDrawBlendMode(SDL_BLENDMODE_NONE);
+  polylineVertices.clear();
+  polylineIndices.clear();
+
+  // each segment is a quad; consecutive quads are joined by a bevel on both
+  // sides of the shared point, and the two ends get square caps
+  int prevEnd = -1; // index of the previous quad's far vertices
+  int lastSegment = count - 1;
+  while (lastSegment > 0 && points[lastSegment].x == points[lastSegment - 1].x &&
+         points[lastSegment].y == points[lastSegment - 1].y) {
+    lastSegment--;
   }
-  SDL_SetRenderDrawColor(ren, 0, 0, 0, 255);
+  for (int i = 1; i <= lastSegment; i++) {
+    SDL_FPoint p0 = {points[i - 1].x - originX, points[i - 1].y - originY};
+    SDL_FPoint p1 = {points[i].x - originX, points[i].y - originY};
+    float dx = p1.x - p0.x;
+    float dy = p1.y - p0.y;
+    float len = sqrtf(dx * dx + dy * dy);
+    if (len == 0) {
+      continue;
+    }
+    float ux = dx / len * halfWidth;
+    float uy = dy / len * halfWidth;
+    if (prevEnd < 0) {
+      p0.x -= ux;
+      p0.y -= uy;
+    }
+    if (i == lastSegment) {
+      p1.x += ux;
+      p1.y += uy;
+    }
+
+    int base = polylineVertices.size();
+    polylineVertices.push_back({{p0.x - uy, p0.y + ux}, c, {0, 0}});
+    polylineVertices.push_back({{p0.x + uy, p0.y - ux}, c, {0, 0}});
+    polylineVertices.push_back({{p1.x - uy, p1.y + ux}, c, {0, 0}});
+    polylineVertices.push_back({{p1.x + uy, p1.y - ux}, c, {0, 0}});
+    polylineIndices.insert(polylineIndices.end(),
+                           {base, base + 1, base + 2, base + 1, base + 3,
+                            base + 2});
+
+    if (prevEnd >= 0) {
+      int centre = polylineVertices.size();
+      polylineVertices.push_back(
+          {{points[i - 1].x - originX, points[i - 1].y - originY}, c, {0, 0}});
+      polylineIndices.insert(polylineIndices.end(),
+                             {centre, prevEnd, base, centre, prevEnd + 1,
+                              base + 1});
+    }
+    prevEnd = base + 2;
+
+    // long lines go out in chunks, so the scratch stays small; the far end
+    // of the last quad is carried over for the next bevel
+    if (polylineVertices.size() >= polylineChunkVertices) {
+      SDL_RenderGeometry(ren, NULL, polylineVertices.data(),
+                         polylineVertices.size(), polylineIndices.data(),
+                         polylineIndices.size());
+      COUNT_CALLS(geometry, 1);
+      SDL_Vertex farEnd[2] = {polylineVertices[prevEnd],
+                              polylineVertices[prevEnd + 1]};
+      polylineVertices.assign(farEnd, farEnd + 2);
+      polylineIndices.clear();
+      prevEnd = 0;
+    }
+  }
+
+  if (!polylineIndices.empty()) {
+    SDL_RenderGeometry(ren, NULL, polylineVertices.data(),
+                       polylineVertices.size(), polylineIndices.data(),
+                       polylineIndices.size());
+    COUNT_CALLS(geometry, 1);
+  }
+}
+
+void Window::textSize(std::string text, GraphicsTools::Font *font, int *w,
+                      int *h) {
+  if (TTF_SizeText(font->font(), text.c_str(), w, h) != 0) {
+    std::cerr << "cannot size text: " << TTF_GetError() << "\n";
+  }
+}
+
+SDL_Texture *Window::createLayer(int w, int h) {
+  if (raster != NULL || !SDL_RenderTargetSupported(ren)) {
+    return NULL;
+  }
+  SDL_Texture *layer = SDL_CreateTexture(ren, SDL_PIXELFORMAT_ARGB8888,
+                                         SDL_TEXTUREACCESS_TARGET, w, h);
+  COUNT_CALLS(textureCreates, 1);
+  if (layer == NULL) {
+    std::cerr << "cannot create layer: " << SDL_GetError() << "\n";
+    return NULL;
+  }
+  // drawing onto a cleared layer leaves colours premultiplied by alpha, so
+  // composite it that way; not every renderer can, so fall back to blending
+  SDL_BlendMode premultiplied = SDL_ComposeCustomBlendMode(
+      SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+      SDL_BLENDOPERATION_ADD, SDL_BLENDFACTOR_ONE,
+      SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+  if (SDL_SetTextureBlendMode(layer, premultiplied) != 0) {
+    SDL_SetTextureBlendMode(layer, SDL_BLENDMODE_BLEND);
+  }
+  return layer;
+}
+
+void Window::destroyLayer(SDL_Texture *layer) {
+  if (layer != NULL) {
+    SDL_DestroyTexture(layer);
+    COUNT_CALLS(textureDestroys, 1);
+  }
+}
+
+void Window::beginLayer(SDL_Texture *layer, int x, int y, bool clear) {
+  layerStack.push_back({SDL_GetRenderTarget(ren), originX, originY});
+  SDL_SetRenderTarget(ren, layer);
+  originX = x;
+  originY = y;
+  if (clear) {
+    setDrawColor(ColorRgba8(0, 0, 0, 0));
+    SDL_RenderClear(ren);
+  }
+}
+
+void Window::eraseRectangle(int x, int y, int w, int h) {
+  if (layerStack.empty()) {
+    return;
+  }
+  // without blending, this replaces the pixels
+  setDrawColor(ColorRgba8(0, 0, 0, 0));
+  setDrawBlendMode(SDL_BLENDMODE_NONE);
+  SDL_Rect target = {x - originX, y - originY, w, h};
+  SDL_RenderFillRect(ren, &target);
+  COUNT_CALLS(fillRects, 1);
+}
+
+void Window::endLayer() {
+  if (layerStack.empty()) {
+    return;
+  }
+  LayerState prev = layerStack.back();
+  layerStack.pop_back();
+  SDL_SetRenderTarget(ren, prev.target);
+  originX = prev.originX;
+  originY = prev.originY;
+}
+
+void Window::drawLayer(SDL_Texture *layer, int x, int y) {
+  TIME_DRAW(drawLayerTime);
+  SDL_Rect pos;
+  pos.x = x - originX;
+  pos.y = y - originY;
+  SDL_QueryTexture(layer, NULL, NULL, &pos.w, &pos.h);
+  SDL_RenderCopy(ren, layer, NULL, &pos);
+  COUNT_CALLS(renderCopies, 1);
 }
 
 } // namespace GraphicsTools
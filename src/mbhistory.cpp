@@ -0,0 +1,222 @@
+#include "mbchart.h"
+#include <cmath>
+#include <cstring>
+
+namespace ChartTools {
+
+    // bits are written most significant first, filling each word in turn
+    static void putBits(std::vector<uint64_t>& words, size_t& bitCount, uint64_t value, int n){
+        if (n == 0){
+            return;
+        }
+        if (n < 64){
+            value &= (1ULL << n) - 1;
+        }
+        int used = bitCount & 63;
+        if (used == 0){
+            words.push_back(0);
+        }
+        int room = 64 - used;
+        if (n <= room){
+            words.back() |= value << (room - n);
+        }
+        else {
+            words.back() |= value >> (n - room);
+            words.push_back(value << (64 - (n - room)));
+        }
+        bitCount += n;
+    }
+
+    namespace {
+    class BitReader {
+    public:
+        BitReader(const std::vector<uint64_t>& w) : words (w.data()), pos (0) {}
+        uint64_t get(int n){
+            if (n == 0){
+                return 0;
+            }
+            size_t word = pos >> 6;
+            int offset = pos & 63;
+            int room = 64 - offset;
+            uint64_t value = (words[word] << offset) >> (64 - n);
+            if (n > room){
+                value |= words[word + 1] >> (64 - (n - room));
+            }
+            pos += n;
+            return value;
+        }
+        // n bits holding -(2^(n-1) - 1) to 2^(n-1)
+        int64_t getSigned(int n){
+            int64_t value = get(n);
+            return (value > (1LL << (n - 1))) ? value - (1LL << n) : value;
+        }
+
+    private:
+        const uint64_t* words;
+        size_t pos;
+    };
+    }
+
+    static uint64_t bitsOf(double d){
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        return bits;
+    }
+
+    static double doubleOf(uint64_t bits){
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+
+    CompressedHistory::CompressedHistory(int maxPointCount, int pointsPerBlock) :
+        maxPoints (maxPointCount), blockSize (std::max(pointsPerBlock, 2)), pointCount (0) {}
+
+    void CompressedHistory::append(const ChartPoint& p){
+        uint64_t x = bitsOf(p.x);
+        uint64_t y = bitsOf(p.y);
+        if (blocks.empty() || blocks.back().count == blockSize){
+            if (!blocks.empty()){
+                // sealed: it won't grow again
+                blocks.back().words.shrink_to_fit();
+            }
+            blocks.push_back(Block({{}, 0, 0, INFINITY, -INFINITY, x, y, 0, -1, 0}));
+            Block& block = blocks.back();
+            block.words.reserve(blockSize / 2);
+            putBits(block.words, block.bitCount, x, 64);
+            putBits(block.words, block.bitCount, y, 64);
+        }
+        else {
+            Block& block = blocks.back();
+
+            // x: the change in the step between bit patterns, which is zero
+            // for evenly spaced values within a binade; wraps like the
+            // unsigned patterns themselves
+            uint64_t delta = x - block.prevX;
+            int64_t dod = (int64_t)(delta - block.prevDelta);
+            if (dod == 0){
+                putBits(block.words, block.bitCount, 0, 1);
+            }
+            else if (dod >= -63 && dod <= 64){
+                putBits(block.words, block.bitCount, 0x2, 2);
+                putBits(block.words, block.bitCount, dod, 7);
+            }
+            else if (dod >= -255 && dod <= 256){
+                putBits(block.words, block.bitCount, 0x6, 3);
+                putBits(block.words, block.bitCount, dod, 9);
+            }
+            else if (dod >= -2047 && dod <= 2048){
+                putBits(block.words, block.bitCount, 0xE, 4);
+                putBits(block.words, block.bitCount, dod, 12);
+            }
+            else {
+                putBits(block.words, block.bitCount, 0xF, 4);
+                putBits(block.words, block.bitCount, dod, 64);
+            }
+            block.prevDelta = delta;
+            block.prevX = x;
+
+            // y: the bits that differ from the previous value, within the
+            // previous window of meaningful bits when they fit in it
+            uint64_t diff = y ^ block.prevY;
+            if (diff == 0){
+                putBits(block.words, block.bitCount, 0, 1);
+            }
+            else {
+                int leading = std::min(__builtin_clzll(diff), 31);
+                int trailing = __builtin_ctzll(diff);
+                if (block.prevLeading >= 0 && leading >= block.prevLeading
+                    && trailing >= block.prevTrailing){
+                    putBits(block.words, block.bitCount, 0x2, 2);
+                    putBits(block.words, block.bitCount, diff >> block.prevTrailing,
+                            64 - block.prevLeading - block.prevTrailing);
+                }
+                else {
+                    int meaningful = 64 - leading - trailing;
+                    putBits(block.words, block.bitCount, 0x3, 2);
+                    putBits(block.words, block.bitCount, leading, 5);
+                    putBits(block.words, block.bitCount, meaningful - 1, 6);
+                    putBits(block.words, block.bitCount, diff >> trailing, meaningful);
+                    block.prevLeading = leading;
+                    block.prevTrailing = trailing;
+                }
+            }
+            block.prevY = y;
+
+        }
+        Block& block = blocks.back();
+        if (p.x < block.minX){
+            block.minX = p.x;
+        }
+        if (p.x > block.maxX){
+            block.maxX = p.x;
+        }
+        block.count++;
+        pointCount++;
+
+        while (pointCount > maxPoints && blocks.size() > 1){
+            pointCount -= blocks.front().count;
+            blocks.pop_front();
+        }
+    }
+
+    void CompressedHistory::clear(){
+        blocks.clear();
+        pointCount = 0;
+    }
+
+    size_t CompressedHistory::bytes() const {
+        size_t total = 0;
+        for (const Block& block : blocks){
+            total += sizeof(Block) + block.words.capacity() * sizeof(uint64_t);
+        }
+        return total;
+    }
+
+    void CompressedHistory::decode(const Block& block, std::vector<ChartPoint>& out) const {
+        BitReader in(block.words);
+        uint64_t x = in.get(64);
+        uint64_t y = in.get(64);
+        out.push_back(ChartPoint(doubleOf(x), doubleOf(y)));
+        uint64_t delta = 0;
+        int leading = 0;
+        int trailing = 0;
+        for (int i = 1; i < block.count; i++){
+            uint64_t dod = 0;
+            if (in.get(1) != 0){
+                if (in.get(1) == 0){
+                    dod = in.getSigned(7);
+                }
+                else if (in.get(1) == 0){
+                    dod = in.getSigned(9);
+                }
+                else if (in.get(1) == 0){
+                    dod = in.getSigned(12);
+                }
+                else {
+                    dod = in.get(64);
+                }
+            }
+            delta += dod;
+            x += delta;
+
+            if (in.get(1) != 0){
+                if (in.get(1) != 0){
+                    leading = in.get(5);
+                    int meaningful = in.get(6) + 1;
+                    trailing = 64 - leading - meaningful;
+                }
+                y ^= in.get(64 - leading - trailing) << trailing;
+            }
+            out.push_back(ChartPoint(doubleOf(x), doubleOf(y)));
+        }
+    }
+
+    void CompressedHistory::read(double xFrom, double xTo, std::vector<ChartPoint>& out) const {
+        for (const Block& block : blocks){
+            if (block.maxX >= xFrom && block.minX <= xTo){
+                decode(block, out);
+            }
+        }
+    }
+}
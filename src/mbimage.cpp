@@ -0,0 +1,126 @@
+#include <iostream>
+
+#include "SDL2/SDL_image.h"
+#include "mbimage.h"
+
+using std::cerr;
+
+namespace GraphicsTools {
+
+ImageLoader::ImageLoader(size_t byteBudget)
+    : budget(byteBudget), takenBytes(0), decodedCount(0), stopping(false) {
+  worker = std::thread(&ImageLoader::workerLoop, this);
+}
+
+ImageLoader::~ImageLoader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  queued.notify_one();
+  worker.join();
+}
+
+std::shared_ptr<ImageLoader> ImageLoader::shared() {
+  static std::mutex sharedMutex;
+  static std::weak_ptr<ImageLoader> instance;
+  std::lock_guard<std::mutex> lock(sharedMutex);
+  std::shared_ptr<ImageLoader> loader = instance.lock();
+  if (!loader) {
+    loader = std::make_shared<ImageLoader>(32 << 20);
+    instance = loader;
+  }
+  return loader;
+}
+
+void ImageLoader::request(const std::string &filename) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entries.count(filename) != 0) {
+      return;
+    }
+    entries[filename] = Entry({Queued, false, NULL, takenOrder.end()});
+    queue.push_back(filename);
+  }
+  queued.notify_one();
+}
+
+std::shared_ptr<SDL_Surface> ImageLoader::take(const std::string &filename,
+                                               bool wait, bool *failed) {
+  request(filename);
+  std::unique_lock<std::mutex> lock(mutex);
+  auto it = entries.find(filename);
+  if (wait) {
+    // another taker may see a failure first and remove the entry
+    done.wait(lock, [&] {
+      it = entries.find(filename);
+      return it == entries.end() || it->second.state != Queued;
+    });
+  }
+  *failed = it == entries.end() || it->second.state == Failed;
+  if (*failed) {
+    if (it != entries.end()) {
+      entries.erase(it);
+    }
+    return NULL;
+  }
+  Entry &entry = it->second;
+  if (entry.state != Ready) {
+    return NULL;
+  }
+  std::shared_ptr<SDL_Surface> surface = entry.surface;
+  if (entry.taken) {
+    takenOrder.splice(takenOrder.begin(), takenOrder, entry.age);
+  } else {
+    entry.taken = true;
+    takenOrder.push_front(filename);
+    entry.age = takenOrder.begin();
+    takenBytes += (size_t)surface->pitch * surface->h;
+    trim();
+  }
+  return surface;
+}
+
+int ImageLoader::decoded() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return decodedCount;
+}
+
+void ImageLoader::trim() {
+  // keeps the most recently taken surface, which its taker is about to use
+  while (takenBytes > budget && takenOrder.size() > 1) {
+    auto it = entries.find(takenOrder.back());
+    takenBytes -= (size_t)it->second.surface->pitch * it->second.surface->h;
+    entries.erase(it);
+    takenOrder.pop_back();
+  }
+}
+
+void ImageLoader::workerLoop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    queued.wait(lock, [this] { return stopping || !queue.empty(); });
+    if (stopping) {
+      return;
+    }
+    std::string filename = queue.front();
+    queue.pop_front();
+    lock.unlock();
+    SDL_Surface *surf = IMG_Load(filename.c_str());
+    if (surf == NULL) {
+      cerr << "cannot load " << filename << ": " << SDL_GetError() << "\n";
+    }
+    lock.lock();
+    Entry &entry = entries[filename];
+    if (surf != NULL) {
+      entry.state = Ready;
+      entry.surface = std::shared_ptr<SDL_Surface>(surf, SDL_FreeSurface);
+      decodedCount++;
+    } else {
+      entry.state = Failed;
+    }
+    done.notify_all();
+  }
+}
+
+} // namespace GraphicsTools
@@ -0,0 +1,388 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "mbraster.h"
+
+using std::cerr;
+
+namespace GraphicsTools {
+
+// tiles are square; 64 rows of 64 ARGB8888 pixels fit in L1
+static const int TILE = 64;
+
+static Uint32 packColor(SDL_Color c) {
+  return 0xFF000000u | ((Uint32)c.r << 16) | ((Uint32)c.g << 8) | c.b;
+}
+
+// src over dst with alpha a (0-255); the framebuffer stays opaque
+static inline Uint32 blendPixel(Uint32 dst, Uint32 src, int a) {
+  Uint32 rb = ((src & 0xFF00FF) * a + (dst & 0xFF00FF) * (255 - a));
+  Uint32 g = ((src & 0xFF00) * a + (dst & 0xFF00) * (255 - a));
+  // x / 255 as (x + 128 + ((x + 128) >> 8)) >> 8, per channel
+  rb += 0x800080;
+  rb = ((rb + ((rb >> 8) & 0xFF00FF)) >> 8) & 0xFF00FF;
+  g += 0x8000;
+  g = ((g + ((g >> 8) & 0xFF00)) >> 8) & 0xFF00;
+  return 0xFF000000u | rb | g;
+}
+
+// a pixel covered by the fraction cov of a shape
+static inline void coverPixel(Uint32 *px, Uint32 color, float cov) {
+  if (cov >= 1) {
+    *px = color;
+  } else if (cov > 0) {
+    *px = blendPixel(*px, color, (int)(cov * 255 + 0.5f));
+  }
+}
+
+std::shared_ptr<RasterImage> MakeRasterImage(SDL_Surface *surface) {
+  SDL_Surface *converted =
+      SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+  if (converted == NULL) {
+    cerr << "cannot convert image: " << SDL_GetError() << "\n";
+    return NULL;
+  }
+  auto image = std::make_shared<RasterImage>();
+  image->w = converted->w;
+  image->h = converted->h;
+  image->pixels.resize((size_t)image->w * image->h);
+  SDL_LockSurface(converted);
+  for (int row = 0; row < image->h; row++) {
+    memcpy(&image->pixels[(size_t)row * image->w],
+           (const char *)converted->pixels + (size_t)row * converted->pitch,
+           (size_t)image->w * 4);
+  }
+  SDL_UnlockSurface(converted);
+  SDL_FreeSurface(converted);
+  return image;
+}
+
+TileRasterizer::TileRasterizer(int w, int h, int threads)
+    : width(w), height(h), tilesX((w + TILE - 1) / TILE),
+      tilesY((h + TILE - 1) / TILE), framebuffer((size_t)w * h, 0xFF000000u),
+      tileCommands((size_t)tilesX * tilesY), generation(0), activeWorkers(0),
+      stopping(false), nextTile(0) {
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // the thread calling render() works too
+  for (int i = 1; i < threads; i++) {
+    workers.emplace_back(&TileRasterizer::workerLoop, this);
+  }
+}
+
+TileRasterizer::~TileRasterizer() {
+  {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+void TileRasterizer::record(Command &c) {
+  c.minX = std::max(c.minX, 0);
+  c.minY = std::max(c.minY, 0);
+  c.maxX = std::min(c.maxX, width - 1);
+  c.maxY = std::min(c.maxY, height - 1);
+  if (c.minX > c.maxX || c.minY > c.maxY) {
+    return;
+  }
+  commands.push_back(c);
+}
+
+void TileRasterizer::clear(SDL_Color color) {
+  // everything recorded so far would be painted over
+  commands.clear();
+  images.clear();
+  fillRect(color, 0, 0, width, height);
+}
+
+void TileRasterizer::fillRect(SDL_Color color, int x, int y, int w, int h) {
+  if (w <= 0 || h <= 0) {
+    return;
+  }
+  Command c = {};
+  c.type = Fill;
+  c.color = packColor(color);
+  c.minX = x;
+  c.minY = y;
+  c.maxX = x + w - 1;
+  c.maxY = y + h - 1;
+  record(c);
+}
+
+void TileRasterizer::drawLine(SDL_Color color, float thickness, float x1,
+                              float y1, float x2, float y2) {
+  Command c = {};
+  c.type = Line;
+  c.color = packColor(color);
+  c.x0 = x1;
+  c.y0 = y1;
+  c.x1 = x2;
+  c.y1 = y2;
+  c.size = std::max(thickness, 1.0f) / 2;
+  // pixels partly covered reach half a pixel beyond the edge
+  float reach = c.size + 0.5f;
+  c.minX = floorf(std::min(x1, x2) - reach);
+  c.minY = floorf(std::min(y1, y2) - reach);
+  c.maxX = ceilf(std::max(x1, x2) + reach);
+  c.maxY = ceilf(std::max(y1, y2) + reach);
+  record(c);
+}
+
+void TileRasterizer::drawCircle(SDL_Color outer, SDL_Color inner, float x,
+                                float y, float r) {
+  if (r <= 0) {
+    return;
+  }
+  Command c = {};
+  c.type = Circle;
+  c.color = packColor(outer);
+  c.color2 = packColor(inner);
+  c.x0 = x;
+  c.y0 = y;
+  c.size = r;
+  c.minX = floorf(x - r - 1);
+  c.minY = floorf(y - r - 1);
+  c.maxX = ceilf(x + r + 1);
+  c.maxY = ceilf(y + r + 1);
+  record(c);
+}
+
+void TileRasterizer::drawImage(std::shared_ptr<const RasterImage> image, int x,
+                               int y, int alpha) {
+  if (image == NULL || alpha <= 0) {
+    return;
+  }
+  Command c = {};
+  c.type = Image;
+  c.color = std::min(alpha, 255);
+  c.image = images.size();
+  c.x0 = x;
+  c.y0 = y;
+  c.minX = x;
+  c.minY = y;
+  c.maxX = x + image->w - 1;
+  c.maxY = y + image->h - 1;
+  size_t before = commands.size();
+  record(c);
+  if (commands.size() != before) {
+    images.push_back(image);
+  }
+}
+
+void TileRasterizer::render() {
+  if (commands.empty()) {
+    return;
+  }
+  // bin: each tile gets the commands overlapping it, in drawing order
+  for (auto &list : tileCommands) {
+    list.clear();
+  }
+  for (int i = 0; i < (int)commands.size(); i++) {
+    const Command &c = commands[i];
+    for (int ty = c.minY / TILE; ty <= c.maxY / TILE; ty++) {
+      for (int tx = c.minX / TILE; tx <= c.maxX / TILE; tx++) {
+        tileCommands[ty * tilesX + tx].push_back(i);
+      }
+    }
+  }
+
+  nextTile = 0;
+  {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    activeWorkers = workers.size();
+    generation++;
+  }
+  wake.notify_all();
+  runTiles();
+  {
+    std::unique_lock<std::mutex> lock(poolMutex);
+    finished.wait(lock, [this] { return activeWorkers == 0; });
+  }
+
+  commands.clear();
+  images.clear();
+}
+
+void TileRasterizer::workerLoop() {
+  unsigned long seen = 0;
+  std::unique_lock<std::mutex> lock(poolMutex);
+  while (true) {
+    wake.wait(lock, [&] { return stopping || generation != seen; });
+    if (stopping) {
+      return;
+    }
+    seen = generation;
+    lock.unlock();
+    runTiles();
+    lock.lock();
+    if (--activeWorkers == 0) {
+      finished.notify_one();
+    }
+  }
+}
+
+void TileRasterizer::runTiles() {
+  int count = tilesX * tilesY;
+  for (int tile = nextTile++; tile < count; tile = nextTile++) {
+    renderTile(tile);
+  }
+}
+
+void TileRasterizer::renderTile(int tile) {
+  int x0 = (tile % tilesX) * TILE;
+  int y0 = (tile / tilesX) * TILE;
+  int x1 = std::min(x0 + TILE, width);
+  int y1 = std::min(y0 + TILE, height);
+  for (int i : tileCommands[tile]) {
+    const Command &c = commands[i];
+    // clip to the command's bounds as well as the tile
+    int cx0 = std::max(x0, c.minX);
+    int cy0 = std::max(y0, c.minY);
+    int cx1 = std::min(x1, c.maxX + 1);
+    int cy1 = std::min(y1, c.maxY + 1);
+    switch (c.type) {
+    case Fill:
+      fillTile(c, cx0, cy0, cx1, cy1);
+      break;
+    case Line:
+      lineTile(c, cx0, cy0, cx1, cy1);
+      break;
+    case Circle:
+      circleTile(c, cx0, cy0, cx1, cy1);
+      break;
+    case Image:
+      imageTile(c, cx0, cy0, cx1, cy1);
+      break;
+    }
+  }
+}
+
+void TileRasterizer::fillTile(const Command &c, int x0, int y0, int x1,
+                              int y1) {
+  for (int y = y0; y < y1; y++) {
+    std::fill_n(&framebuffer[(size_t)y * width + x0], x1 - x0, c.color);
+  }
+}
+
+// Pixel coverage of a thick line is its half width plus half a pixel, less
+// the distance from the pixel centre to the segment. Each row only visits
+// the pixels near the part of the segment within reach of that row.
+void TileRasterizer::lineTile(const Command &c, int x0, int y0, int x1,
+                              int y1) {
+  float dx = c.x1 - c.x0;
+  float dy = c.y1 - c.y0;
+  float len2 = dx * dx + dy * dy;
+  float reach = c.size + 0.5f;
+  for (int y = y0; y < y1; y++) {
+    float yc = y + 0.5f;
+    float ta = 0, tb = 1;
+    if (fabsf(dy) < 1e-6f) {
+      if (fabsf(c.y0 - yc) > reach) {
+        continue;
+      }
+    } else {
+      ta = (yc - reach - c.y0) / dy;
+      tb = (yc + reach - c.y0) / dy;
+      if (ta > tb) {
+        std::swap(ta, tb);
+      }
+      ta = std::max(ta, 0.0f);
+      tb = std::min(tb, 1.0f);
+      if (ta > tb) {
+        continue;
+      }
+    }
+    float xa = c.x0 + dx * ta;
+    float xb = c.x0 + dx * tb;
+    if (xa > xb) {
+      std::swap(xa, xb);
+    }
+    int from = std::max(x0, (int)floorf(xa - reach));
+    int to = std::min(x1, (int)ceilf(xb + reach) + 1);
+    Uint32 *row = &framebuffer[(size_t)y * width];
+    for (int x = from; x < to; x++) {
+      float xc = x + 0.5f;
+      float t = 0;
+      if (len2 > 0) {
+        t = ((xc - c.x0) * dx + (yc - c.y0) * dy) / len2;
+        t = std::clamp(t, 0.0f, 1.0f);
+      }
+      float ex = c.x0 + t * dx - xc;
+      float ey = c.y0 + t * dy - yc;
+      coverPixel(&row[x], c.color, reach - sqrtf(ex * ex + ey * ey));
+    }
+  }
+}
+
+// The same shape and gradient as Window's circle sprites, with the edge
+// anti-aliased: colours are weighted by the whole-pixel distance d from
+// the centre as (outer * d + inner * (r - d)) / r.
+void TileRasterizer::circleTile(const Command &c, int x0, int y0, int x1,
+                                int y1) {
+  float r = c.size;
+  float edge = sqrtf(std::max(r * r - r, 0.0f)) + 0.5f;
+  float outer[3], inner[3];
+  for (int ch = 0; ch < 3; ch++) {
+    outer[ch] = (c.color >> (16 - 8 * ch)) & 0xFF;
+    inner[ch] = (c.color2 >> (16 - 8 * ch)) & 0xFF;
+  }
+  // sprites are centred on the middle of the pixel at (x, y)
+  float cx = c.x0 + 0.5f;
+  float cy = c.y0 + 0.5f;
+  for (int y = y0; y < y1; y++) {
+    float ey = y + 0.5f - cy;
+    float span2 = edge * edge - ey * ey;
+    if (span2 < 0) {
+      continue;
+    }
+    float span = sqrtf(span2);
+    int from = std::max(x0, (int)floorf(cx - span));
+    int to = std::min(x1, (int)ceilf(cx + span) + 1);
+    Uint32 *row = &framebuffer[(size_t)y * width];
+    for (int x = from; x < to; x++) {
+      float ex = x + 0.5f - cx;
+      float dist = sqrtf(ex * ex + ey * ey);
+      float cov = edge - dist;
+      if (cov <= 0) {
+        continue;
+      }
+      float d = std::min((float)(int)dist, r);
+      Uint32 color = 0xFF000000u;
+      for (int ch = 0; ch < 3; ch++) {
+        Uint32 v = (outer[ch] * d + inner[ch] * (r - d)) / r;
+        color |= v << (16 - 8 * ch);
+      }
+      coverPixel(&row[x], color, cov);
+    }
+  }
+}
+
+void TileRasterizer::imageTile(const Command &c, int x0, int y0, int x1,
+                               int y1) {
+  const RasterImage &image = *images[c.image];
+  int ix = c.x0;
+  int iy = c.y0;
+  int alpha = c.color;
+  for (int y = y0; y < y1; y++) {
+    const Uint32 *src = image.pixels.data() + (size_t)(y - iy) * image.w;
+    Uint32 *row = &framebuffer[(size_t)y * width];
+    for (int x = x0; x < x1; x++) {
+      Uint32 s = src[x - ix];
+      int a = (s >> 24) * alpha / 255;
+      if (a == 255) {
+        row[x] = s;
+      } else if (a > 0) {
+        row[x] = blendPixel(row[x], s, a);
+      }
+    }
+  }
+}
+
+} // namespace GraphicsTools